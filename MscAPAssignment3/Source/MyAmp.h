@@ -13,6 +13,7 @@
     * ampEnvDecay: Specifies the time for the envelope to ramp down to the sustain value
     * ampEnvSustain: Specifies the level the envelope will remain at after decay and before release
     * ampEnvRelease: Specifies the time for the envelope to ramp down fulls after the note stops
+    * ampEnvCurve: Whether the envelope stages are linear or exponential
     * ampDistOn: Whether to apply the distortion
     * ampDistGain: How much gain to apply in the distortion
     * ampVolume: Final master volume.
@@ -35,18 +36,33 @@
 
 #pragma once
 
+#include <climits>
 #include <cmath>
 #include <JuceHeader.h>
+#include "MyArena.h"
+#include "MyEnvelope.h"
 #include "MyParameters.h"
 
 class MyAmp
 {
 public:
-    MyAmp (MyParameters* _params) : params (_params)
+    MyAmp (MyParameters* _params) :
+    params (_params),
+    envWatcher (_params, { "amp_env_attack", "amp_env_decay", "amp_env_sustain", "amp_env_release", "amp_env_curve" })
     {
         // empty
     }
 
+    /**
+     Takes the envelope buffer from the arena. Called from the arena's layout function.
+
+     @param arena The arena being laid out
+     */
+    void allocate (MyArena& arena)
+    {
+        envBuffer = arena.allocate<float> (MyEnvelope::maxBlockSize);
+    }
+
     void startNote (float velocity)
     {
         ampEnv.reset();
@@ -60,71 +76,123 @@ public:
         ampEnv.noteOff();
     }
 
+    /**
+     @return Roughly how loud the voice is, from the envelope and velocity
+     */
+    float getLevel() const
+    {
+        return velocityGain * ampEnv.getValue();
+    }
+
     bool isClosed()
     {
-        return envVal < 0.000001f;
+        return ! ampEnv.isActive();
     }
 
-    float apply (float sample, bool applyLfoToAmpVolume, bool applyLfoToAmpDist, float lfoSample)
+    /**
+     @return The number of samples before the envelope moves to its next stage, or INT_MAX if it is holding its level
+     */
+    int getSamplesUntilNextStage() const
     {
-        envVal = ampEnv.getNextSample();
-        float envSample = velocityGain * (envVal * sample);
+        return ampEnv.getSamplesUntilNextStage();
+    }
 
-        float distSample;
-        if (params->ampDistOn->get())
-            distSample = tanh (getAmpDist (applyLfoToAmpDist, lfoSample) * envSample);
-        else
-            distSample = envSample;
+    /**
+     Applies the envelope, velocity, distortion and volume to a block of samples in place.
 
-        return getAmpVolume (applyLfoToAmpVolume, lfoSample) * distSample;
-    }
+     The distortion switch and the LFO routing are template parameters so that the loop for each combination has no
+     branches on them. The voice splits its chunks where the envelope changes stage, so a chunk in the sustain stage
+     uses the envelope's level as a constant instead of rendering it.
 
-    float getAmpDist (float applyLfo, float lfoSample)
+     @param buffer The samples to apply the amp to
+     @param numSamples The number of samples in the buffer
+     @param lfoBuffer The LFO samples for this block, only read if the LFO applies to the amp
+     */
+    template <bool distOn, bool applyLfoToAmpVolume, bool applyLfoToAmpDist>
+    void renderBlock (float* buffer, int numSamples, const float* lfoBuffer)
     {
-        float ampDistGain = *params->ampDistGain;
-
-        if (applyLfo)
+        if (ampEnv.getSamplesUntilNextStage() == INT_MAX)
         {
-            return std::max (0.0f, ampDistGain + (lfoSample * ampDistGain));
+            applyBlock<distOn, applyLfoToAmpVolume, applyLfoToAmpDist, true> (buffer, numSamples, lfoBuffer);
         }
         else
         {
-            return ampDistGain;
+            ampEnv.renderBlock (envBuffer, numSamples);
+            applyBlock<distOn, applyLfoToAmpVolume, applyLfoToAmpDist, false> (buffer, numSamples, lfoBuffer);
         }
     }
 
-    float getAmpVolume (bool applyLfo, float lfoSample)
+    static float getAmpDist (float ampDistGain, float lfoSample)
     {
-        float ampVolume = *params->ampVolume;
+        return std::max (0.0f, ampDistGain + (lfoSample * ampDistGain));
+    }
 
-        if (applyLfo)
-        {
-            float lfoVolume = ampVolume + (lfoSample * ampVolume);
-            return std::max (0.0f, std::min (1.0f, lfoVolume));
-        }
-        else
-        {
-            return ampVolume;
-        }
+    static float getAmpVolume (float ampVolume, float lfoSample)
+    {
+        float lfoVolume = ampVolume + (lfoSample * ampVolume);
+        return std::max (0.0f, std::min (1.0f, lfoVolume));
     }
 
+    /**
+     Updates the envelope, but only if its parameters or the sample rate have changed.
+
+     @param sampleRate The current sample rate
+     */
     void updateParams (float sampleRate)
     {
+        if (sampleRate != lastSampleRate)
+        {
+            lastSampleRate = sampleRate;
+            envWatcher.forceChanged();
+        }
+
+        if (! envWatcher.hasChanged())
+            return;
+
         ampEnv.setSampleRate (sampleRate);
         ampEnvParams.attack = *params->ampEnvAttack;
         ampEnvParams.decay = *params->ampEnvDecay;
         ampEnvParams.sustain = *params->ampEnvSustain;
         ampEnvParams.release = *params->ampEnvRelease;
-        ampEnv.setParameters (ampEnvParams);
+        ampEnv.setParameters (ampEnvParams, MyEnvelope::Curve (params->ampEnvCurve->getIndex()));
     }
 
 private:
     MyParameters* params;
 
-    juce::ADSR ampEnv;
-    juce::ADSR::Parameters ampEnvParams;
+    /**
+     The per sample part of renderBlock, compiled separately for when the envelope holds its level for the whole block
+     and envBuffer is not rendered.
+     */
+    template <bool distOn, bool applyLfoToAmpVolume, bool applyLfoToAmpDist, bool envelopeHeld>
+    void applyBlock (float* buffer, int numSamples, const float* lfoBuffer)
+    {
+        float ampDistGain = *params->ampDistGain;
+        float ampVolume = *params->ampVolume;
+        float heldLevel = ampEnv.getValue();
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            float envelope = envelopeHeld ? heldLevel : envBuffer[i];
+            float sample = velocityGain * (envelope * buffer[i]);
 
-    float velocityGain;
+            if constexpr (distOn)
+            {
+                float distGain = applyLfoToAmpDist ? getAmpDist (ampDistGain, lfoBuffer[i]) : ampDistGain;
+                sample = tanh (distGain * sample);
+            }
 
-    float envVal = 0;
+            float volume = applyLfoToAmpVolume ? getAmpVolume (ampVolume, lfoBuffer[i]) : ampVolume;
+            buffer[i] = volume * sample;
+        }
+    }
+
+    MyEnvelope ampEnv;
+    MyEnvelope::Parameters ampEnvParams;
+    float* envBuffer = nullptr;
+
+    MyParameterWatcher envWatcher;
+    float lastSampleRate = 0.0f;
+
+    float velocityGain;
 };
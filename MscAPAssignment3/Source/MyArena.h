@@ -0,0 +1,178 @@
+/*
+  ==============================================================================
+
+    MyArena.h
+
+    This is the single block of memory that holds most of the plugin's DSP
+    buffers: the voices' scratch and modulation buffers, the delay lines and
+    the reverb's mono and reduced rate buffers. It is allocated in
+    prepareToPlay from the sample rate and the largest block the host will
+    send, so nothing is allocated while playing whatever block sizes the host
+    uses, and getSize is the memory these take for each instance.
+
+    Some buffers are still outside it: the juce::Reverb tanks, which allocate
+    their own, the engine rate, block adapter and pipeline buffers, and the
+    sample streams' ring buffers (MySampler.h). These are allocated before
+    playback too, but are not locked.
+
+    The buffers are laid out one after another in the order they are asked
+    for, each starting on its own cache line, so a voice's buffers sit next
+    to each other and the effects follow the voices.
+
+    The layout is worked out by running the same layout function twice. The
+    first time nothing is handed out and the arena only adds up the sizes,
+    the second time the memory has been allocated and each call gets its
+    share of it. The memory starts cleared. Buffers that are never in use
+    at the same time, such as the lines of the three delay types, can be
+    laid out with overlap so that they share the same memory.
+
+    The arena can also be locked once it is prepared. Every page is written
+    to so that it is faulted in before playback rather than in the middle of
+    a callback, and on Linux the memory is asked to be backed by huge pages
+    and locked with mlock so that it can never be swapped out. Locking is
+    limited by RLIMIT_MEMLOCK, and if the limit is too low the pages are
+    still faulted in but may be swapped out under memory pressure.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <JuceHeader.h>
+
+#if JUCE_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+class MyArena
+{
+public:
+    /// Every buffer starts on a cache line
+    static constexpr size_t alignment = 64;
+
+    ~MyArena()
+    {
+        unlockMemory();
+    }
+
+    /**
+     Lays out and allocates the arena, freeing the last one. Not real time safe.
+
+     @param layout Called with this arena, and must ask for the same buffers every time. Must not touch the memory it
+                   is given, as the first call is given nullptr for every buffer.
+     */
+    template <typename LayoutFunction>
+    void prepare (LayoutFunction&& layout)
+    {
+        unlockMemory();
+
+        base = nullptr;
+        used = 0;
+        layout (*this);
+
+        size_t size = used;
+        memory.allocate (size + alignment, true);
+        base = reinterpret_cast<char*> ((reinterpret_cast<juce::pointer_sized_uint> (memory.get()) + alignment - 1) & ~(juce::pointer_sized_uint) (alignment - 1));
+
+        used = 0;
+        layout (*this);
+        jassert (used == size);
+    }
+
+    /**
+     Takes the next buffer from the arena. Only to be called from the layout function given to prepare.
+
+     @param count The number of elements in the buffer
+     @return The buffer, or nullptr while the arena is being measured
+     */
+    template <typename Type>
+    Type* allocate (size_t count)
+    {
+        size_t offset = used;
+        used += ((count * sizeof (Type)) + alignment - 1) & ~(alignment - 1);
+        return base == nullptr ? nullptr : reinterpret_cast<Type*> (base + offset);
+    }
+
+    /**
+     Lays out several sets of buffers over the same memory, for buffers that are never in use at the same time. Each
+     function takes its buffers from the same place and the arena carries on after the largest set. Only to be called
+     from the layout function given to prepare.
+
+     @param layouts Functions that are each called with this arena
+     */
+    template <typename... LayoutFunctions>
+    void overlap (LayoutFunctions&&... layouts)
+    {
+        size_t start = used;
+        size_t end = used;
+        ((used = start, layouts (*this), end = std::max (end, used)), ...);
+        used = end;
+    }
+
+    /**
+     Faults in every page of the arena and, on Linux, asks for huge pages and locks it in RAM. Not real time safe, so
+     only call this after prepare. The lock is released when the arena is next prepared.
+
+     @return True if the arena is locked in RAM
+     */
+    bool lockMemory()
+    {
+        if (base == nullptr || used == 0)
+            return false;
+
+#if JUCE_LINUX
+        // madvise and mlock work on whole pages, so only the pages entirely inside the arena are advised
+        auto pageSize = (juce::pointer_sized_uint) getpagesize();
+        auto start = reinterpret_cast<juce::pointer_sized_uint> (base);
+        auto firstPage = (start + pageSize - 1) & ~(pageSize - 1);
+        auto endPage = (start + used) & ~(pageSize - 1);
+        if (endPage > firstPage)
+            madvise (reinterpret_cast<void*> (firstPage), endPage - firstPage, MADV_HUGEPAGE);
+#endif
+
+        // The memory is already cleared, but calloc hands out large blocks as untouched zero pages that are only
+        // faulted in when first written.
+        std::memset (base, 0, used);
+
+#if JUCE_LINUX
+        if (mlock (base, used) == 0)
+            isLocked = true;
+#endif
+
+        return isLocked;
+    }
+
+    /**
+     @return True if the arena is locked in RAM
+     */
+    bool isMemoryLocked() const
+    {
+        return isLocked;
+    }
+
+    /**
+     @return The size in bytes of every buffer in the arena
+     */
+    size_t getSize() const
+    {
+        return used;
+    }
+
+private:
+    juce::HeapBlock<char> memory;
+    char* base = nullptr;
+    size_t used = 0;
+    bool isLocked = false;
+
+    void unlockMemory()
+    {
+#if JUCE_LINUX
+        if (isLocked)
+            munlock (base, used);
+#endif
+        isLocked = false;
+    }
+};
@@ -0,0 +1,160 @@
+/*
+  ==============================================================================
+
+    MyBlockAdapter.h
+
+    This renders the plugin in fixed blocks of 64 or 128 samples whatever size
+    the host asks for. Some hosts call processBlock with 16 or 32 samples, or
+    with a different size every time, and then the per block work in the
+    voices, delays and reverb costs more than the samples themselves.
+
+    Whole blocks are rendered into a FIFO and the host is given what it asks
+    for from there. There are two ways of lining this up:
+
+    * With latency: Output lags by one block, which is reported to the host.
+      A block is only rendered once all of the host's MIDI for it has arrived,
+      so every event lands on the exact sample it should.
+    * Zero latency: Blocks are rendered as soon as the host needs the samples
+      and any left over are kept for the next call. Nothing is delayed, but
+      MIDI that arrives for samples already rendered is played at the start
+      of the next block, up to one block late.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+class MyBlockAdapter
+{
+public:
+    /**
+     Sizes the FIFO. Not real time safe.
+
+     @param blockSizeChoice The index of the block size parameter: host, 64 or 128
+     @param _zeroLatency True to render ahead instead of reporting latency
+     @param maxHostSamples The most samples the host will ask for at once
+     @param _numChannels The number of output channels
+     @return The size of the blocks the plugin will be rendered in
+     */
+    int prepare (int blockSizeChoice, bool _zeroLatency, int maxHostSamples, int _numChannels)
+    {
+        static constexpr int blockSizes[] = { 0, 64, 128 };
+
+        blockSize = blockSizes[blockSizeChoice];
+        zeroLatency = _zeroLatency;
+        numChannels = _numChannels;
+
+        if (blockSize == 0)
+            return maxHostSamples;
+
+        blockBuffer.setSize (numChannels, blockSize);
+        fifo.setSize (numChannels, blockSize + maxHostSamples);
+        pendingMidi.ensureSize (2048);
+        laterMidi.ensureSize (2048);
+        blockMidi.ensureSize (2048);
+
+        reset();
+        return blockSize;
+    }
+
+    void reset()
+    {
+        fifo.clear();
+        pendingMidi.clear();
+
+        // The silence that makes up the latency
+        numAvailable = getLatency();
+    }
+
+    /**
+     @return The latency in samples, which is a whole block unless zero latency is on
+     */
+    int getLatency() const
+    {
+        return (blockSize == 0 || zeroLatency) ? 0 : blockSize;
+    }
+
+    /**
+     Renders a host block, in fixed size blocks if the adapter is on.
+
+     @param hostBuffer The buffer to fill
+     @param hostMidi The MIDI events for the host block
+     @param numSamples The number of samples the host wants
+     @param renderBlock Called with a buffer, its MIDI and a number of samples to render
+     */
+    template <typename RenderFunction>
+    void process (juce::AudioBuffer<float>& hostBuffer, const juce::MidiBuffer& hostMidi, int numSamples, RenderFunction&& renderBlock)
+    {
+        if (blockSize == 0)
+        {
+            renderBlock (hostBuffer, hostMidi, numSamples);
+            return;
+        }
+
+        // Events are kept relative to the first sample not yet rendered. Host sample 0 is numAvailable samples before
+        // it, less the latency, so anything that comes out negative was meant for samples already rendered.
+        int offset = getLatency() - numAvailable;
+        for (const auto metadata : hostMidi)
+            pendingMidi.addEvent (metadata.data, metadata.numBytes, std::max (0, metadata.samplePosition + offset));
+
+        while (numAvailable < numSamples)
+        {
+            takeBlockMidi();
+
+            blockBuffer.clear();
+            renderBlock (blockBuffer, blockMidi, blockSize);
+
+            for (int channel = 0; channel < numChannels; channel++)
+                fifo.copyFrom (channel, numAvailable, blockBuffer, channel, 0, blockSize);
+            numAvailable += blockSize;
+        }
+
+        int channelsToWrite = std::min (numChannels, hostBuffer.getNumChannels());
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            float* samples = fifo.getWritePointer (channel);
+            if (channel < channelsToWrite)
+                hostBuffer.copyFrom (channel, 0, samples, numSamples);
+
+            // Fewer than a block is ever left, so this is a short move
+            std::copy (samples + numSamples, samples + numAvailable, samples);
+        }
+        numAvailable -= numSamples;
+    }
+
+private:
+    int blockSize = 0;
+    bool zeroLatency = false;
+    int numChannels = 2;
+
+    juce::AudioBuffer<float> blockBuffer;
+
+    // Rendered samples waiting to be given to the host
+    juce::AudioBuffer<float> fifo;
+    int numAvailable = 0;
+
+    juce::MidiBuffer pendingMidi;
+    juce::MidiBuffer laterMidi;
+    juce::MidiBuffer blockMidi;
+
+    /**
+     Moves the pending events that fall in the next block into blockMidi and moves the rest a block earlier.
+     */
+    void takeBlockMidi()
+    {
+        blockMidi.clear();
+        laterMidi.clear();
+
+        for (const auto metadata : pendingMidi)
+        {
+            if (metadata.samplePosition < blockSize)
+                blockMidi.addEvent (metadata.data, metadata.numBytes, metadata.samplePosition);
+            else
+                laterMidi.addEvent (metadata.data, metadata.numBytes, metadata.samplePosition - blockSize);
+        }
+
+        pendingMidi.swapWith (laterMidi);
+    }
+};
@@ -0,0 +1,156 @@
+/*
+  ==============================================================================
+
+    MyBypass.h
+
+    This switches an effect on and off without clicks. Rather than the effect
+    dropping out between one sample and the next, two gains are faded over
+    20ms:
+
+    * The input gain: How much of the signal goes into the effect, and how
+      far the dry signal is moved from unity to the effect's dry level.
+    * The wet gain: How much of the effect's output is heard.
+
+    Normally both fade out together. With tails on, only the input is faded
+    and the effect carries on running so that what is already in it rings
+    out. The effect reports how loud its output was each block, and once it
+    has been silent for long enough for nothing more to come out the wet gain
+    is faded too.
+
+    Once both gains reach zero the effect stops processing, and it can then
+    clear its state a little at a time over the following blocks rather than
+    all at once.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <limits>
+
+class MyBypass
+{
+public:
+    /// How long the effect takes to fade in or out
+    static constexpr double fadeSeconds = 0.02;
+
+    /// The level below which a tail counts as silent, -100dB
+    static constexpr float silenceLevel = 1.0e-5f;
+
+    /**
+     Works out how long an effect's feedback loop takes to go silent, for reporting its tail to the host.
+
+     @param loopSeconds The time round the loop
+     @param feedback The gain each time round the loop
+     @return The time until the loop has fallen below silenceLevel, or infinity if it never does
+     */
+    static double getFeedbackTailSeconds (double loopSeconds, double feedback)
+    {
+        if (feedback >= 1.0)
+            return std::numeric_limits<double>::infinity();
+
+        // Even with no feedback the input comes out once, a whole loop later
+        double passes = feedback > silenceLevel ? std::ceil (std::log (double (silenceLevel)) / std::log (feedback)) : 1.0;
+        return loopSeconds * std::max (1.0, passes);
+    }
+
+    /**
+     @param sampleRate The sample rate the fades are timed for
+     @param on True if the effect starts switched on, in which case it starts without fading in
+     */
+    void prepare (double sampleRate, bool on)
+    {
+        inputGain.reset (sampleRate, fadeSeconds);
+        wetGain.reset (sampleRate, fadeSeconds);
+        inputGain.setCurrentAndTargetValue (on ? 1.0f : 0.0f);
+        wetGain.setCurrentAndTargetValue (on ? 1.0f : 0.0f);
+        ringing = false;
+        silentSamples = 0;
+    }
+
+    /**
+     Starts any fades and works out whether the effect has anything to do. Called at the start of every block.
+
+     @param on True if the effect is switched on
+     @param keepTail True to let the effect ring out when it is switched off
+     @return True if the effect should process the block, false once it is switched off and has faded or rung out
+     */
+    bool beginBlock (bool on, bool keepTail)
+    {
+        if (on)
+        {
+            ringing = false;
+        }
+        else if (inputGain.getTargetValue() > 0.0f)
+        {
+            // Just switched off
+            ringing = keepTail;
+            silentSamples = 0;
+        }
+        else if (! keepTail)
+        {
+            ringing = false;
+        }
+
+        inputGain.setTargetValue (on ? 1.0f : 0.0f);
+        wetGain.setTargetValue ((on || ringing) ? 1.0f : 0.0f);
+
+        return wetGain.isSmoothing() || wetGain.getTargetValue() > 0.0f;
+    }
+
+    /**
+     Lets the bypass know how loud the effect's output was so it can tell when a tail has rung out. Called at the end of
+     every block the effect processes.
+
+     @param peak The loudest sample of the effect's wet output in the block
+     @param numSamples The number of samples in the block
+     @param tailSamples How many silent samples in a row mean that nothing more can come out of the effect
+     */
+    void endBlock (float peak, int numSamples, int tailSamples)
+    {
+        if (! ringing)
+            return;
+
+        silentSamples = peak < silenceLevel ? silentSamples + numSamples : 0;
+        if (silentSamples >= tailSamples)
+        {
+            ringing = false;
+            wetGain.setTargetValue (0.0f);
+        }
+    }
+
+    float getNextInputGain()
+    {
+        return inputGain.getNextValue();
+    }
+
+    float getNextWetGain()
+    {
+        return wetGain.getNextValue();
+    }
+
+    /**
+     Writes the gains for a run of samples, for effects that process a block at a time.
+
+     @param inputGains Where to write the input gain for each sample
+     @param wetGains Where to write the wet gain for each sample
+     @param numSamples The number of samples
+     */
+    void fillGains (float* inputGains, float* wetGains, int numSamples)
+    {
+        for (int i = 0; i < numSamples; i++)
+        {
+            inputGains[i] = inputGain.getNextValue();
+            wetGains[i] = wetGain.getNextValue();
+        }
+    }
+
+private:
+    juce::SmoothedValue<float> inputGain;
+    juce::SmoothedValue<float> wetGain;
+
+    bool ringing = false;
+    int silentSamples = 0;
+};
@@ -5,7 +5,7 @@
     Created: Apr/May 2022
     Author: B191392
     
-    This file contains 2 different delay effect implementations. The first,
+    This file contains 3 different delay effect implementations. The first,
     MyPingPongDelay is a stereo effect where the echoes created by the delay
     alternate being in the left or right channel with how far left or right
     determined by a depth parameter. The second is a delay that maintains the
@@ -14,59 +14,356 @@
     the other paramaters are shared:
  
     * delayOn: Whether the delay effect is to be applied or bypassed
-    * delayType: Which of the two delay types to use
-    * delayTime: The time between the original and delayed signal
+    * delayType: Which of the three delay types to use
+    * delayTime: The time between the original and delayed signal, up to 2 seconds
+    * delayLongTime: Used in place of delayTime when delayMaxTime is longer than 2 seconds
     * delayWetLevel: How much of the delayed signal is in the output
     * delayDryLevel: How much of the original signal is in the output
     * delayFeedback: How much of the delayed sample is fed back into the buffer to give more repeated echoes
     * delayDepth: How far left and right the Ping Pong delay travels
+
+    The third, MyMultiTapDelay, reads up to 16 taps from one mono delay line,
+    each with its own time, gain and pan (delayTaps and the delayTap arrays).
+    It uses the wet, dry and feedback levels above in place of delayTime and
+    delayDepth, and only the longest tap is fed back, so the whole pattern of
+    taps repeats. Rather than running every tap a sample at a time it works on
+    runs of samples: each tap is gathered into a buffer in one tight loop and
+    mixed into the output with JUCE's vector operations. A run is never longer
+    than the shortest tap, so the taps only ever read samples written before
+    the run. Taps are kept to at least 1ms so that the runs stay long enough
+    for this to pay off.
+
+    The delayed samples are read with linear interpolation in the Eco quality
+    mode and 4 point cubic (Hermite) interpolation otherwise.
+
+    The delay lines are sized for the longest delay at the sample rate and
+    live in the processor's arena (MyArena.h), which lays them out before
+    prepareToPlay is called. The longest delay is picked with delayMaxTime
+    (2, 8 or 32 seconds), so only instances that need long delays pay for
+    the memory, and the delay time is limited to it. The lines are stored
+    at the full sample rate, so their memory grows with the max time. At
+    32 seconds and 96kHz the Ping Pong delay's lines, which are twice as
+    long as the others, take 49MB, or 25MB with delayCompact. Long delays
+    are not stored at a reduced rate, so going from 2 to 32 seconds always
+    costs 16 times the memory. Only one delay type runs at a time, so the
+    three share the same memory, and the processor calls discardLines on a
+    delay when it is chosen again after another type has been writing over
+    its lines.
+
+    With delayCompact on, the delay lines are stored as 16 bit bfloat16
+    samples instead of floats, which halves their memory. Each delay is
+    compiled for both storage types so the per sample loop never checks
+    which one is in use. bfloat16 only keeps 8 bits of precision, so every
+    pass round the feedback loop adds rounding noise about 48dB below the
+    signal. That is fine for short, dark echoes but builds up audibly on
+    long tails with high feedback, where floats are the better choice.
+
+    Switching the delay on or off fades it in or out (see MyBypass.h), and
+    with delayTails on the echoes already in the delay ring out instead.
+    Once the delay has gone quiet the delay lines are cleared a chunk at a
+    time over the following blocks, so that switching the delay off never
+    has to clear seconds of samples in one callback. If it is switched back
+    on before they are clear, the delay starts writing from the start of
+    the lines again and the clearing carries on in chunks as it plays. Only
+    as much as the delay time can read is cleared straight away (see
+    MyDelayLine).
     
   ==============================================================================
 */
 
 #pragma once
 
+#include "MyArena.h"
+#include "MyBypass.h"
 #include "MyParameters.h"
 #include <JuceHeader.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/**
+ 4 point, 3rd order Hermite interpolation between y0 and y1.
+
+ @param yMinus1 The sample before y0
+ @param y0 The sample at t = 0
+ @param y1 The sample at t = 1
+ @param y2 The sample after y1
+ @param t How far between y0 and y1, from 0 to 1
+ */
+inline float getHermiteSample (float yMinus1, float y0, float y1, float y2, float t)
+{
+    float c1 = 0.5f * (y1 - yMinus1);
+    float c2 = yMinus1 - (2.5f * y0) + (2.0f * y1) - (0.5f * y2);
+    float c3 = (0.5f * (y2 - yMinus1)) + (1.5f * (y0 - y1));
+    return (((c3 * t) + c2) * t + c1) * t + y0;
+}
+
+/**
+ Converts between floats and the 16 bit brain float format (bfloat16) used by compact delay lines. It keeps the
+ float's sign, its 8 bit exponent and the top 7 bits of its mantissa, so the range is the same as a float's and
+ converting back is a single shift. Both directions are branch free so the compiler can vectorise them.
+ */
+struct MyCompactSample
+{
+    /**
+     Rounds to the nearest bfloat16, with ties going to the even value.
+     */
+    static uint16_t fromFloat (float value)
+    {
+        uint32_t bits;
+        std::memcpy (&bits, &value, sizeof (bits));
+        bits += 0x7fffu + ((bits >> 16) & 1u);
+        return uint16_t (bits >> 16);
+    }
+
+    static float toFloat (uint16_t sample)
+    {
+        uint32_t bits = uint32_t (sample) << 16;
+        float value;
+        std::memcpy (&value, &bits, sizeof (value));
+        return value;
+    }
+};
+
+/**
+ A ring buffer of delayed samples in the arena, stored either as floats or as compact 16 bit samples. The storage is
+ fixed when the buffer is laid out, and the reads and writes are told at compile time which one it is.
+
+ The line keeps track of whether it has been written to, so that once its delay is bypassed it can be cleared a
+ chunk at a time with clearSome. The chunks work down from the end of the ring. If the delay is switched back on
+ before the ring is clear, beginWriting moves the write index back to the start of the ring, so the delay only reads
+ the end of the ring until it has written enough new samples. Only as much of the end as the delay can read is
+ cleared straight away, and the rest carries on a chunk at a time until it meets the write index.
+ */
+class MyDelayLine
+{
+public:
+    /// How many samples are cleared in each block while the line is being cleared
+    static constexpr int clearChunkSize = 16384;
+
+    /**
+     Takes the buffer from the arena. Called from the arena's layout function.
+
+     @param arena The arena being laid out
+     @param _size The number of samples in the ring
+     @param _compact True to store bfloat16 samples, false for floats
+     */
+    void allocate (MyArena& arena, int _size, bool _compact)
+    {
+        size = _size;
+        compact = _compact;
+        samples = compact ? nullptr : arena.allocate<float> ((size_t) size);
+        compactSamples = compact ? arena.allocate<uint16_t> ((size_t) size) : nullptr;
+    }
+
+    /**
+     Sets every sample to zero, which is also all zero bits in bfloat16. This clears the whole ring at once, so it is
+     only for prepareToPlay.
+     */
+    void clear()
+    {
+        clear (0, size);
+        state = State::clean;
+    }
+
+    /**
+     Treats every sample as old, such as after another delay has used the same memory, so that the ring is cleared
+     again before it is read.
+     */
+    void discard()
+    {
+        state = State::clearing;
+        clearedFrom = size;
+    }
+
+    /**
+     Clears the next chunk of the ring while the delay is bypassed. Does nothing once it is clear.
+     */
+    void clearSome()
+    {
+        if (state == State::clean)
+            return;
+
+        if (state == State::inUse)
+            clearedFrom = size;
+
+        // Anything written since being switched back on is below clearedFrom, so is cleared along with the rest
+        state = State::clearing;
+        int start = std::max (0, clearedFrom - clearChunkSize);
+        clear (start, clearedFrom);
+        clearedFrom = start;
+
+        if (clearedFrom == 0)
+            state = State::clean;
+    }
+
+    /**
+     Gets the line ready for a block of the delay running, before anything is read from it.
+
+     @param writeIndex Where the delay will write next
+     @param readSpan The furthest back from the write index that the delay can read during the block
+     @return Where the delay should write next, which is the start of the ring if it was being cleared
+     */
+    int beginWriting (int writeIndex, int readSpan)
+    {
+        if (state == State::clean)
+            state = State::inUse;
+
+        if (state == State::clearing)
+        {
+            state = State::clearingAhead;
+            writeIndex = 0;
+        }
+
+        if (state == State::clearingAhead)
+        {
+            // The reads wrap round to the end of the ring until readSpan samples have been written
+            int readFrom = size - juce::jlimit (0, size, readSpan - writeIndex);
+            int start = std::max (writeIndex, std::min (readFrom, clearedFrom - clearChunkSize));
+            if (start < clearedFrom)
+            {
+                clear (start, clearedFrom);
+                clearedFrom = start;
+            }
+
+            // The write index has caught up with the cleared end, so everything the delay reads is its own
+            if (clearedFrom <= writeIndex)
+                state = State::inUse;
+        }
+
+        return writeIndex;
+    }
+
+    bool isCompact() const
+    {
+        return compact;
+    }
+
+    int getSize() const
+    {
+        return size;
+    }
+
+    template <bool compactStorage>
+    float read (int index) const
+    {
+        if constexpr (compactStorage)
+            return MyCompactSample::toFloat (compactSamples[index]);
+        else
+            return samples[index];
+    }
+
+    template <bool compactStorage>
+    void write (int index, float value)
+    {
+        if constexpr (compactStorage)
+            compactSamples[index] = MyCompactSample::fromFloat (value);
+        else
+            samples[index] = value;
+    }
+
+private:
+    enum class State
+    {
+        // Every sample is zero
+        clean,
+        // Written to since the ring was last clear
+        inUse,
+        // Being cleared while the delay is bypassed, clear from clearedFrom to the end
+        clearing,
+        // Written from the start again, clear from clearedFrom to the end with old samples between the write index
+        // and clearedFrom
+        clearingAhead
+    };
+
+    float* samples = nullptr;
+    uint16_t* compactSamples = nullptr;
+    int size = 0;
+    bool compact = false;
+
+    State state = State::clean;
+    int clearedFrom = 0;
+
+    void clear (int start, int end)
+    {
+        if (compact)
+            std::fill (compactSamples + start, compactSamples + end, uint16_t (0));
+        else
+            std::fill (samples + start, samples + end, 0.0f);
+    }
+};
 
 class MyPingPongDelay
 {
 public:
-    MyPingPongDelay (MyParameters* _params) : params (_params)
+    MyPingPongDelay (MyParameters* _params) :
+    params (_params),
+    paramWatcher (_params, { "delay_delay_time", "delay_long_time" })
     {
     }
 
-    ~MyPingPongDelay()
+    /**
+     Takes the delay lines from the arena. Called from the arena's layout function, before prepareToPlay.
+
+     @param arena The arena being laid out
+     @param _sampleRate The sample rate to size the delay lines for
+     @param _maxDelayTime The longest delay time in seconds
+     @param compact True to store the delay lines as 16 bit samples
+     */
+    void allocate (MyArena& arena, double _sampleRate, float _maxDelayTime, bool compact)
     {
-        delete leftDelayBuffer;
-        delete rightDelayBuffer;
+        maxDelayTime = _maxDelayTime;
+
+        // The right channel is delayed twice as long, and the cubic interpolation reads one sample past the delay
+        bufferSize = int (std::ceil (2 * maxDelayTime * _sampleRate)) + 2;
+        leftDelayLine.allocate (arena, bufferSize, compact);
+        rightDelayLine.allocate (arena, bufferSize, compact);
     }
 
     void prepareToPlay (double _sampleRate)
     {
         sampleRate = _sampleRate;
-        resetBuffers();
+        clearBuffers();
+        bypass.prepare (sampleRate, params->delayOn->get());
         smoothDelayInSamples.reset (_sampleRate, 0.1f);
         smoothDelayInSamples.setCurrentAndTargetValue (0.5f * sampleRate);
 
         smoothFrequency.reset (_sampleRate, 0.1f);
         smoothDelayInSamples.setCurrentAndTargetValue (0.5f * sampleRate);
+
+        paramWatcher.forceChanged();
+    }
+
+    /**
+     @return How long the echoes carry on after the input stops, until the longer right channel loop is silent
+     */
+    double getTailSeconds() const
+    {
+        double delayTime = params->getDelayTime (maxDelayTime);
+        float feedback = *params->delayFeedback;
+        return std::max (MyBypass::getFeedbackTailSeconds (delayTime, feedback),
+                         MyBypass::getFeedbackTailSeconds (2.0 * delayTime, feedback / 2.0f));
+    }
+
+    /**
+     Called when the delay is chosen again after another delay type has used the same memory.
+     */
+    void discardLines()
+    {
+        leftDelayLine.discard();
+        rightDelayLine.discard();
     }
 
     void apply (juce::AudioBuffer<float>& buffer, int numSamples, int numChannels)
     {
-        if (! params->delayOn->get())
+        if (! bypass.beginBlock (params->delayOn->get(), params->delayTails->get()))
         {
-            if (! emptyBuffers)
-            {
-                clearBuffers();
-            }
+            leftDelayLine.clearSome();
+            rightDelayLine.clearSome();
             return;
         }
 
-        emptyBuffers = false;
-
         float* leftChannel = buffer.getWritePointer (0);
         float* rightChannel = nullptr;
 
@@ -77,10 +374,62 @@ public:
             rightChannel = buffer.getWritePointer (1);
         }
 
+        if (paramWatcher.hasChanged())
+            updateParams();
+
+        // Both lines are given the right channel's longer span so that they are always cleared together
+        float longestDelay = std::max (smoothDelayInSamples.getCurrentValue(), smoothDelayInSamples.getTargetValue());
+        int readSpan = int (2 * longestDelay) + 3;
+        int writeIndex = leftDelayLine.beginWriting (currentIndex, readSpan);
+        rightDelayLine.beginWriting (currentIndex, readSpan);
+        currentIndex = writeIndex;
+
+        cubicInterpolation = params->quality.getSettings().cubicDelayInterpolation;
+
+        if (leftDelayLine.isCompact())
+            applyWith<true> (leftChannel, rightChannel, numSamples);
+        else
+            applyWith<false> (leftChannel, rightChannel, numSamples);
+    }
+
+private:
+    MyParameters* params;
+
+    MyDelayLine leftDelayLine;
+    MyDelayLine rightDelayLine;
+    float maxDelayTime = 2.0f;
+
+    float sampleRate;
+
+    juce::SmoothedValue<float> smoothDelayInSamples;
+    juce::SmoothedValue<float> smoothFrequency;
+
+    MyParameterWatcher paramWatcher;
+
+    MyBypass bypass;
+
+    int bufferSize;
+    int currentIndex;
+    bool cubicInterpolation = true;
+
+    /**
+     Runs the delay over the block, compiled for each storage type of the delay lines.
+
+     @param leftChannel The left channel
+     @param rightChannel The right channel, or nullptr if the buffer is mono
+     @param numSamples The number of samples to process
+     */
+    template <bool compact>
+    void applyWith (float* leftChannel, float* rightChannel, int numSamples)
+    {
+        bool rightChannelAvailable = rightChannel != nullptr;
+        float peak = 0.0f;
+
         for (int sampleIndex = 0; sampleIndex < numSamples; sampleIndex++)
         {
-            updateParams();
             float exactDelayInSamples = smoothDelayInSamples.getNextValue();
+            float inputGain = bypass.getNextInputGain();
+            float wetGain = bypass.getNextWetGain();
 
             float originalLeftSample = leftChannel[sampleIndex];
             float originalRightSample;
@@ -95,48 +444,41 @@ public:
                 originalSample = leftChannel[sampleIndex];
             }
 
-            float delayedLeftSample = getInterpolatedDelayedSample (leftDelayBuffer, exactDelayInSamples);
-            float delayedRightSample = getInterpolatedDelayedSample (rightDelayBuffer, 2 * exactDelayInSamples);
+            float delayedLeftSample = getInterpolatedDelayedSample<compact> (leftDelayLine, exactDelayInSamples);
+            float delayedRightSample = getInterpolatedDelayedSample<compact> (rightDelayLine, 2 * exactDelayInSamples);
+            peak = std::max (peak, std::max (std::abs (delayedLeftSample), std::abs (delayedRightSample)));
 
-            leftDelayBuffer[currentIndex] = originalSample + (*params->delayFeedback * delayedLeftSample);
-            rightDelayBuffer[currentIndex] = originalSample + ((*params->delayFeedback / 2.0f) * delayedRightSample);
+            float delayInput = inputGain * originalSample;
+            leftDelayLine.write<compact> (currentIndex, delayInput + (*params->delayFeedback * delayedLeftSample));
+            rightDelayLine.write<compact> (currentIndex, delayInput + ((*params->delayFeedback / 2.0f) * delayedRightSample));
 
             float sameChannelGain = *params->delayDepth;
             float otherChannelGain = 1 - sameChannelGain;
 
-            float delayWetLevel = *params->delayWetLevel;
+            // The dry level moves from unity to its setting as the delay fades in
+            float dryLevel = 1.0f + (inputGain * (*params->delayDryLevel - 1.0f));
+            float delayWetLevel = wetGain * *params->delayWetLevel;
             float leveledDelayedLeftSample = delayWetLevel * delayedLeftSample;
             float leveledDelayedRightSample = delayWetLevel * delayedRightSample;
-            leftChannel[sampleIndex] = (*params->delayDryLevel * originalLeftSample)
+            leftChannel[sampleIndex] = (dryLevel * originalLeftSample)
                                        + (sameChannelGain * leveledDelayedLeftSample)
                                        + (otherChannelGain * leveledDelayedRightSample);
 
             if (rightChannelAvailable)
             {
-                rightChannel[sampleIndex] = (*params->delayDryLevel * originalRightSample)
+                rightChannel[sampleIndex] = (dryLevel * originalRightSample)
                                             + (sameChannelGain * leveledDelayedRightSample)
                                             + (otherChannelGain * leveledDelayedLeftSample);
             }
             incrementCurrentIndex();
         }
-    }
-
-private:
-    MyParameters* params;
-
-    float* leftDelayBuffer = nullptr;
-    float* rightDelayBuffer = nullptr;
-
-    float sampleRate;
-
-    juce::SmoothedValue<float> smoothDelayInSamples;
-    juce::SmoothedValue<float> smoothFrequency;
 
-    int bufferSize;
-    int currentIndex;
-    bool emptyBuffers;
+        // Nothing more can come out once the longer right channel delay has been silent
+        bypass.endBlock (peak, numSamples, int (2 * smoothDelayInSamples.getTargetValue()) + numSamples);
+    }
 
-    float getInterpolatedDelayedSample (float* buffer, float exactDelayInSamples)
+    template <bool compact>
+    float getInterpolatedDelayedSample (const MyDelayLine& buffer, float exactDelayInSamples)
     {
         int delayInSamplesInt = std::floor (exactDelayInSamples);
 
@@ -145,14 +487,22 @@ private:
         int rightIndex = ((currentIndex - delayInSamplesInt) + bufferSize) % bufferSize;
         int leftIndex = (rightIndex - 1 + bufferSize) % bufferSize;
 
-        float delayedSample = ((1 - delayInSamplesDecimal) * buffer[leftIndex]) + (delayInSamplesDecimal * buffer[rightIndex]);
+        // The newer outer sample would not have been written yet for very short delays
+        if (cubicInterpolation && delayInSamplesInt >= 2)
+        {
+            int olderIndex = (leftIndex - 1 + bufferSize) % bufferSize;
+            int newerIndex = (rightIndex + 1) % bufferSize;
+            return getHermiteSample (buffer.read<compact> (olderIndex), buffer.read<compact> (leftIndex), buffer.read<compact> (rightIndex), buffer.read<compact> (newerIndex), delayInSamplesDecimal);
+        }
+
+        float delayedSample = ((1 - delayInSamplesDecimal) * buffer.read<compact> (leftIndex)) + (delayInSamplesDecimal * buffer.read<compact> (rightIndex));
 
         return delayedSample;
     }
 
     void updateParams()
     {
-        float delayTime = *params->delayTime;
+        float delayTime = params->getDelayTime (maxDelayTime);
         smoothDelayInSamples.setTargetValue (delayTime * sampleRate);
         smoothFrequency.setTargetValue (1.0f / (2 * delayTime));
     }
@@ -162,72 +512,80 @@ private:
         currentIndex = (currentIndex + 1) % bufferSize;
     }
 
-    void resetBuffers()
-    {
-        bufferSize = std::ceil (4 * sampleRate) + 1;
-
-        if (leftDelayBuffer != nullptr)
-        {
-            delete leftDelayBuffer;
-        }
-
-        if (rightDelayBuffer != nullptr)
-        {
-            delete rightDelayBuffer;
-        }
-
-        leftDelayBuffer = new float[bufferSize];
-        rightDelayBuffer = new float[bufferSize];
-        clearBuffers();
-    }
-
     void clearBuffers()
     {
-        for (int i = 0; i < bufferSize; i++)
-        {
-            leftDelayBuffer[i] = 0.0f;
-            rightDelayBuffer[i] = 0.0f;
-        }
+        leftDelayLine.clear();
+        rightDelayLine.clear();
         currentIndex = 0;
-        emptyBuffers = true;
     }
+
 };
 
 class MyDelay
 {
 public:
-    MyDelay (MyParameters* _params) : params (_params)
+    MyDelay (MyParameters* _params) :
+    params (_params),
+    paramWatcher (_params, { "delay_delay_time", "delay_long_time" })
     {
         // empty
     }
 
-    ~MyDelay()
+    /**
+     Takes the delay lines from the arena. Called from the arena's layout function, before prepareToPlay.
+
+     @param arena The arena being laid out
+     @param _sampleRate The sample rate to size the delay lines for
+     @param _maxDelayTime The longest delay time in seconds
+     @param compact True to store the delay lines as 16 bit samples
+     */
+    void allocate (MyArena& arena, double _sampleRate, float _maxDelayTime, bool compact)
     {
-        delete leftBuffer;
-        delete rightBuffer;
+        maxDelayTime = _maxDelayTime;
+
+        // The cubic interpolation reads one sample past the delay
+        bufferSize = int (std::ceil (maxDelayTime * _sampleRate)) + 2;
+        leftBuffer.allocate (arena, bufferSize, compact);
+        rightBuffer.allocate (arena, bufferSize, compact);
     }
 
     void prepareToPlay (double _sampleRate)
     {
         sampleRate = _sampleRate;
-        resetBuffers();
+        clearBuffers();
+        bypass.prepare (sampleRate, params->delayOn->get());
         smoothDelaySamples.reset (_sampleRate, 0.1f);
         smoothDelaySamples.setCurrentAndTargetValue (0.5f * sampleRate);
+
+        paramWatcher.forceChanged();
+    }
+
+    /**
+     @return How long the echoes carry on after the input stops
+     */
+    double getTailSeconds() const
+    {
+        return MyBypass::getFeedbackTailSeconds (params->getDelayTime (maxDelayTime), *params->delayFeedback);
+    }
+
+    /**
+     Called when the delay is chosen again after another delay type has used the same memory.
+     */
+    void discardLines()
+    {
+        leftBuffer.discard();
+        rightBuffer.discard();
     }
 
     void apply (juce::AudioBuffer<float>& buffer, int numSamples, int numChannels)
     {
-        if (! params->delayOn->get())
+        if (! bypass.beginBlock (params->delayOn->get(), params->delayTails->get()))
         {
-            if (! emptyBuffers)
-            {
-                clearBuffers();
-            }
+            leftBuffer.clearSome();
+            rightBuffer.clearSome();
             return;
         }
 
-        emptyBuffers = false;
-
         float* leftChannel = buffer.getWritePointer (0);
         float* rightChannel = nullptr;
 
@@ -238,35 +596,75 @@ public:
             rightChannel = buffer.getWritePointer (1);
         }
 
-        for (int i = 0; i < numSamples; i++)
-        {
+        if (paramWatcher.hasChanged())
             updateParams();
-            float delaySamples = smoothDelaySamples.getNextValue();
 
-            applyDelay (leftChannel, i, leftBuffer, delaySamples);
-            if (rightChannelAvailable)
-            {
-                applyDelay (rightChannel, i, rightBuffer, delaySamples);
-            }
-            incrementCurrentIndex();
-        }
+        int readSpan = int (std::max (smoothDelaySamples.getCurrentValue(), smoothDelaySamples.getTargetValue())) + 3;
+        int writeIndex = leftBuffer.beginWriting (currentIndex, readSpan);
+        rightBuffer.beginWriting (currentIndex, readSpan);
+        currentIndex = writeIndex;
+
+        cubicInterpolation = params->quality.getSettings().cubicDelayInterpolation;
+
+        if (leftBuffer.isCompact())
+            applyWith<true> (leftChannel, rightChannel, numSamples);
+        else
+            applyWith<false> (leftChannel, rightChannel, numSamples);
     }
 
 private:
     MyParameters* params;
 
-    float* leftBuffer = nullptr;
-    float* rightBuffer = nullptr;
+    MyDelayLine leftBuffer;
+    MyDelayLine rightBuffer;
+    float maxDelayTime = 2.0f;
 
     float sampleRate;
 
     juce::SmoothedValue<float> smoothDelaySamples;
 
+    MyParameterWatcher paramWatcher;
+
+    MyBypass bypass;
+
     int bufferSize;
     int currentIndex;
-    bool emptyBuffers;
+    bool cubicInterpolation = true;
+
+    /**
+     Runs the delay over the block, compiled for each storage type of the delay lines.
+
+     @param leftChannel The left channel
+     @param rightChannel The right channel, or nullptr if the buffer is mono
+     @param numSamples The number of samples to process
+     */
+    template <bool compact>
+    void applyWith (float* leftChannel, float* rightChannel, int numSamples)
+    {
+        float peak = 0.0f;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            float delaySamples = smoothDelaySamples.getNextValue();
+            float inputGain = bypass.getNextInputGain();
+            float wetGain = bypass.getNextWetGain();
+
+            peak = std::max (peak, applyDelay<compact> (leftChannel, i, leftBuffer, delaySamples, inputGain, wetGain));
+            if (rightChannel != nullptr)
+            {
+                peak = std::max (peak, applyDelay<compact> (rightChannel, i, rightBuffer, delaySamples, inputGain, wetGain));
+            }
+            incrementCurrentIndex();
+        }
+
+        bypass.endBlock (peak, numSamples, int (smoothDelaySamples.getTargetValue()) + numSamples);
+    }
 
-    void applyDelay (float* channel, int sampleIndex, float* buffer, float delaySamples)
+    /**
+     @return The size of the delayed sample, for telling when the tail has rung out
+     */
+    template <bool compact>
+    float applyDelay (float* channel, int sampleIndex, MyDelayLine& buffer, float delaySamples, float inputGain, float wetGain)
     {
         float originalSample = channel[sampleIndex];
 
@@ -277,16 +675,30 @@ private:
         int rightIndex = ((currentIndex - sampleDelay) + bufferSize) % bufferSize;
         int leftIndex = (rightIndex - 1 + bufferSize) % bufferSize;
 
-        float delayedSample = ((1 - decimal) * buffer[leftIndex]) + (decimal * buffer[rightIndex]);
+        float delayedSample;
+        if (cubicInterpolation && sampleDelay >= 2)
+        {
+            int olderIndex = (leftIndex - 1 + bufferSize) % bufferSize;
+            int newerIndex = (rightIndex + 1) % bufferSize;
+            delayedSample = getHermiteSample (buffer.read<compact> (olderIndex), buffer.read<compact> (leftIndex), buffer.read<compact> (rightIndex), buffer.read<compact> (newerIndex), decimal);
+        }
+        else
+        {
+            delayedSample = ((1 - decimal) * buffer.read<compact> (leftIndex)) + (decimal * buffer.read<compact> (rightIndex));
+        }
 
-        float newSample = channel[sampleIndex] = (*params->delayDryLevel * originalSample) + (*params->delayWetLevel * delayedSample);
-        buffer[currentIndex] = originalSample + (*params->delayFeedback * delayedSample);
+        // The dry level moves from unity to its setting as the delay fades in
+        float dryLevel = 1.0f + (inputGain * (*params->delayDryLevel - 1.0f));
+        float newSample = (dryLevel * originalSample) + (wetGain * *params->delayWetLevel * delayedSample);
+        buffer.write<compact> (currentIndex, (inputGain * originalSample) + (*params->delayFeedback * delayedSample));
         channel[sampleIndex] = newSample;
+
+        return std::abs (delayedSample);
     }
 
     void updateParams()
     {
-        smoothDelaySamples.setTargetValue (*params->delayTime * sampleRate);
+        smoothDelaySamples.setTargetValue (params->getDelayTime (maxDelayTime) * sampleRate);
     }
 
     void incrementCurrentIndex()
@@ -294,34 +706,327 @@ private:
         currentIndex = (currentIndex + 1) % bufferSize;
     }
 
-    void resetBuffers()
+    void clearBuffers()
+    {
+        leftBuffer.clear();
+        rightBuffer.clear();
+        currentIndex = 0;
+    }
+
+};
+
+
+class MyMultiTapDelay
+{
+public:
+    MyMultiTapDelay (MyParameters* _params) :
+    params (_params)
+    {
+        // empty
+    }
+
+    /**
+     Takes the delay line and the scratch buffers from the arena. Called from the arena's layout function, before
+     prepareToPlay.
+
+     @param arena The arena being laid out
+     @param _sampleRate The sample rate to size the delay line for
+     @param _maxDelayTime The longest delay time in seconds
+     @param maxBlockSize The most samples that will be given to apply at once
+     @param compact True to store the delay line as 16 bit samples
+     */
+    void allocate (MyArena& arena, double _sampleRate, float _maxDelayTime, int maxBlockSize, bool compact)
+    {
+        maxDelayTime = _maxDelayTime;
+        scratchSize = std::max (maxBlockSize, 1);
+
+        // A power of two so that the read positions wrap with a mask, which keeps the tap loops free of branches
+        bufferSize = juce::nextPowerOfTwo (int (std::ceil (maxDelayTime * _sampleRate)) + 2);
+        bufferMask = bufferSize - 1;
+        delayLine.allocate (arena, bufferSize, compact);
+
+        monoInput = arena.allocate<float> ((size_t) scratchSize);
+        tapSamples = arena.allocate<float> ((size_t) scratchSize);
+        feedbackSamples = arena.allocate<float> ((size_t) scratchSize);
+        wetLeft = arena.allocate<float> ((size_t) scratchSize);
+        wetRight = arena.allocate<float> ((size_t) scratchSize);
+        inputGains = arena.allocate<float> ((size_t) scratchSize);
+        wetGains = arena.allocate<float> ((size_t) scratchSize);
+    }
+
+    void prepareToPlay (double _sampleRate)
+    {
+        sampleRate = _sampleRate;
+        clearBuffers();
+        bypass.prepare (sampleRate, params->delayOn->get());
+
+        for (int tap = 0; tap < MyParameters::maxDelayTaps; tap++)
+        {
+            tapDelays[tap].reset (_sampleRate, 0.1f);
+            tapDelays[tap].setCurrentAndTargetValue (getTapDelay (tap));
+        }
+    }
+
+    /**
+     @return How long the echoes carry on after the input stops, which the longest tap sets as only it is fed back
+     */
+    double getTailSeconds() const
     {
-        bufferSize = std::ceil (2 * sampleRate) + 1;
+        int taps = juce::jlimit (1, MyParameters::maxDelayTaps, int (*params->delayTaps));
+        float longest = minTapTime;
+        for (int tap = 0; tap < taps; tap++)
+            longest = std::max (longest, juce::jlimit (minTapTime, maxDelayTime, params->delayTapTimes[tap]->load()));
 
-        if (leftBuffer != nullptr)
+        return MyBypass::getFeedbackTailSeconds (longest, *params->delayFeedback);
+    }
+
+    /**
+     Called when the delay is chosen again after another delay type has used the same memory.
+     */
+    void discardLines()
+    {
+        delayLine.discard();
+    }
+
+    void apply (juce::AudioBuffer<float>& buffer, int numSamples, int numChannels)
+    {
+        if (! bypass.beginBlock (params->delayOn->get(), params->delayTails->get()))
         {
-            delete leftBuffer;
+            delayLine.clearSome();
+            return;
         }
 
-        if (rightBuffer != nullptr)
+        float* leftChannel = buffer.getWritePointer (0);
+        float* rightChannel = numChannels > 1 ? buffer.getWritePointer (1) : nullptr;
+
+        updateTaps();
+        currentIndex = delayLine.beginWriting (currentIndex, getLongestDelay() + 3);
+        cubicInterpolation = params->quality.getSettings().cubicDelayInterpolation;
+
+        float peak = 0.0f;
+        int start = 0;
+        while (start < numSamples)
         {
-            delete rightBuffer;
+            // The newest sample the cubic interpolation reads must be from before the run
+            int runSize = std::min ({ numSamples - start, scratchSize, getShortestDelay() - 1 });
+            float* rightRun = rightChannel != nullptr ? rightChannel + start : nullptr;
+
+            if (delayLine.isCompact())
+                peak = std::max (peak, applyRun<true> (leftChannel + start, rightRun, runSize));
+            else
+                peak = std::max (peak, applyRun<false> (leftChannel + start, rightRun, runSize));
+
+            start += runSize;
         }
 
-        leftBuffer = new float[bufferSize];
-        rightBuffer = new float[bufferSize];
-        clearBuffers();
+        // Nothing more can come out once the longest tap, the one that is fed back, has been silent
+        bypass.endBlock (peak, numSamples, int (tapDelays[longestTap].getTargetValue()) + numSamples);
     }
 
-    void clearBuffers()
+private:
+    MyParameters* params;
+
+    MyDelayLine delayLine;
+    float maxDelayTime = 2.0f;
+
+    /// The shortest tap in seconds, as each run of samples is no longer than the shortest tap
+    static constexpr float minTapTime = 0.001f;
+
+    float sampleRate;
+
+    // Each tap's delay in samples is smoothed, and its gain and pan are turned into a gain for each channel
+    juce::SmoothedValue<float> tapDelays[MyParameters::maxDelayTaps];
+    float tapLeftGains[MyParameters::maxDelayTaps] = {};
+    float tapRightGains[MyParameters::maxDelayTaps] = {};
+    int numTaps = 1;
+    int longestTap = 0;
+
+    MyBypass bypass;
+
+    int bufferSize;
+    int bufferMask;
+    int currentIndex;
+    bool cubicInterpolation = true;
+
+    // Scratch buffers for one run of samples
+    int scratchSize = 0;
+    float* monoInput = nullptr;
+    float* tapSamples = nullptr;
+    float* feedbackSamples = nullptr;
+    float* wetLeft = nullptr;
+    float* wetRight = nullptr;
+    float* inputGains = nullptr;
+    float* wetGains = nullptr;
+
+    /**
+     Runs every tap over a run of samples no longer than the shortest tap, compiled for each storage type of the
+     delay line.
+
+     @param leftChannel The left channel, from the start of the run
+     @param rightChannel The right channel from the start of the run, or nullptr if the buffer is mono
+     @param numSamples The number of samples in the run
+     @return The loudest sample of the taps, for telling when the tail has rung out
+     */
+    template <bool compact>
+    float applyRun (float* leftChannel, float* rightChannel, int numSamples)
+    {
+        bypass.fillGains (inputGains, wetGains, numSamples);
+
+        // The taps all read one mono line, like the ping pong delay
+        if (rightChannel != nullptr)
+        {
+            juce::FloatVectorOperations::add (monoInput, leftChannel, rightChannel, numSamples);
+            juce::FloatVectorOperations::multiply (monoInput, 0.5f, numSamples);
+        }
+        else
+        {
+            juce::FloatVectorOperations::copy (monoInput, leftChannel, numSamples);
+        }
+        juce::FloatVectorOperations::multiply (monoInput, inputGains, numSamples);
+
+        juce::FloatVectorOperations::clear (wetLeft, numSamples);
+        juce::FloatVectorOperations::clear (wetRight, numSamples);
+
+        for (int tap = 0; tap < numTaps; tap++)
+        {
+            float startDelay = tapDelays[tap].getCurrentValue();
+            float delayStep = (tapDelays[tap].skip (numSamples) - startDelay) / float (numSamples);
+
+            if (cubicInterpolation)
+                gatherTap<compact, true> (startDelay, delayStep, numSamples);
+            else
+                gatherTap<compact, false> (startDelay, delayStep, numSamples);
+
+            juce::FloatVectorOperations::addWithMultiply (wetLeft, tapSamples, tapLeftGains[tap], numSamples);
+            juce::FloatVectorOperations::addWithMultiply (wetRight, tapSamples, tapRightGains[tap], numSamples);
+
+            if (tap == longestTap)
+                juce::FloatVectorOperations::copy (feedbackSamples, tapSamples, numSamples);
+        }
+
+        float feedback = *params->delayFeedback;
+        for (int i = 0; i < numSamples; i++)
+            delayLine.write<compact> ((currentIndex + i) & bufferMask, monoInput[i] + (feedback * feedbackSamples[i]));
+
+        auto leftRange = juce::FloatVectorOperations::findMinAndMax (wetLeft, numSamples);
+        auto rightRange = juce::FloatVectorOperations::findMinAndMax (wetRight, numSamples);
+        float peak = std::max ({ -leftRange.getStart(), leftRange.getEnd(), -rightRange.getStart(), rightRange.getEnd() });
+
+        // The dry level moves from unity to its setting as the delay fades in
+        float dryLevel = *params->delayDryLevel;
+        float wetLevel = *params->delayWetLevel;
+        for (int i = 0; i < numSamples; i++)
+        {
+            float dryGain = 1.0f + (inputGains[i] * (dryLevel - 1.0f));
+            float wetGain = wetGains[i] * wetLevel;
+
+            if (rightChannel != nullptr)
+            {
+                leftChannel[i] = (dryGain * leftChannel[i]) + (wetGain * wetLeft[i]);
+                rightChannel[i] = (dryGain * rightChannel[i]) + (wetGain * wetRight[i]);
+            }
+            else
+            {
+                leftChannel[i] = (dryGain * leftChannel[i]) + (wetGain * 0.5f * (wetLeft[i] + wetRight[i]));
+            }
+        }
+
+        currentIndex = (currentIndex + numSamples) & bufferMask;
+
+        return peak;
+    }
+
+    /**
+     Reads one tap for a run of samples into tapSamples. The delay moves linearly across the run as it is smoothed.
+
+     @param startDelay The tap's delay in samples at the start of the run
+     @param delayStep How much the delay changes each sample
+     @param numSamples The number of samples in the run
+     */
+    template <bool compact, bool cubic>
+    void gatherTap (float startDelay, float delayStep, int numSamples)
+    {
+        for (int i = 0; i < numSamples; i++)
+        {
+            float delay = startDelay + (delayStep * float (i));
+            int wholeDelay = int (delay);
+            float fraction = delay - float (wholeDelay);
+
+            int newerIndex = (currentIndex + i - wholeDelay) & bufferMask;
+            int olderIndex = (newerIndex - 1) & bufferMask;
+
+            if constexpr (cubic)
+            {
+                tapSamples[i] = getHermiteSample (delayLine.read<compact> ((newerIndex + 1) & bufferMask),
+                                                  delayLine.read<compact> (newerIndex),
+                                                  delayLine.read<compact> (olderIndex),
+                                                  delayLine.read<compact> ((olderIndex - 1) & bufferMask),
+                                                  fraction);
+            }
+            else
+            {
+                float newerSample = delayLine.read<compact> (newerIndex);
+                tapSamples[i] = newerSample + (fraction * (delayLine.read<compact> (olderIndex) - newerSample));
+            }
+        }
+    }
+
+    /**
+     @return The tap's delay in samples, at least minTapTime so that the runs are never only a few samples long
+     */
+    float getTapDelay (int tap)
     {
-        for (int i = 0; i < bufferSize; i++)
+        float delayTime = juce::jlimit (minTapTime, maxDelayTime, params->delayTapTimes[tap]->load());
+        return juce::jlimit (2.0f, float (bufferSize - 3), delayTime * sampleRate);
+    }
+
+    void updateTaps()
+    {
+        numTaps = juce::jlimit (1, MyParameters::maxDelayTaps, int (*params->delayTaps));
+        longestTap = 0;
+
+        for (int tap = 0; tap < numTaps; tap++)
         {
-            leftBuffer[i] = 0.0f;
-            rightBuffer[i] = 0.0f;
+            tapDelays[tap].setTargetValue (getTapDelay (tap));
+            if (tapDelays[tap].getTargetValue() > tapDelays[longestTap].getTargetValue())
+                longestTap = tap;
+
+            // Constant power panning, at unity in the centre like the voices
+            float gain = *params->delayTapGains[tap];
+            float panAngle = (*params->delayTapPans[tap] + 1.0f) * juce::MathConstants<float>::pi / 4.0f;
+            tapLeftGains[tap] = gain * juce::MathConstants<float>::sqrt2 * std::cos (panAngle);
+            tapRightGains[tap] = gain * juce::MathConstants<float>::sqrt2 * std::sin (panAngle);
         }
+    }
+
+    /**
+     @return The shortest whole delay of any tap over the next run, as the delays only move towards their targets
+     */
+    int getShortestDelay()
+    {
+        float shortest = float (bufferSize);
+        for (int tap = 0; tap < numTaps; tap++)
+            shortest = std::min ({ shortest, tapDelays[tap].getCurrentValue(), tapDelays[tap].getTargetValue() });
+
+        return int (shortest);
+    }
+
+    /**
+     @return The longest whole delay of any tap over the next block
+     */
+    int getLongestDelay()
+    {
+        float longest = 0.0f;
+        for (int tap = 0; tap < numTaps; tap++)
+            longest = std::max ({ longest, tapDelays[tap].getCurrentValue(), tapDelays[tap].getTargetValue() });
+
+        return int (longest);
+    }
+
+    void clearBuffers()
+    {
+        delayLine.clear();
         currentIndex = 0;
-        emptyBuffers = true;
     }
-};
 
+};
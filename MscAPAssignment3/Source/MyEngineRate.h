@@ -0,0 +1,277 @@
+/*
+  ==============================================================================
+
+    MyEngineRate.h
+
+    This lets the voices run at a lower internal rate than the host's. At 88.2,
+    96, 176.4 and 192kHz the voices, LFOs and envelopes would otherwise do 2 or
+    4 times more work than the audible content needs.
+
+    * MyUpsampler: A polyphase FIR interpolator that raises the rate by a
+      whole factor. Each of the factor phases of a windowed sinc low pass is
+      run over the input, so no zeros are ever multiplied.
+    * MyEngineRate: Renders the synth at the host rate divided by 2 or 4,
+      whichever keeps it at 44.1kHz or more, and upsamples the summed bus to
+      the host rate. The delay and reverb still run at the host rate.
+
+    Host blocks that are not a multiple of the factor are handled by rendering
+    one engine sample too many and keeping the extra host samples for the next
+    block. MIDI events are moved to the engine sample they fall in. A block
+    short enough to be covered by the samples kept from the last one renders
+    nothing, and its MIDI events are held for the start of the next render.
+
+    The filter delays the output by factor * 16 - 1 host samples, which is
+    reported to the host as latency. The engine rate is only picked up when
+    the host prepares the plugin, as the latency cannot change mid-playback.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <JuceHeader.h>
+
+class MyUpsampler
+{
+public:
+    /// The length of each phase of the filter, the full filter is factor times this
+    static constexpr int tapsPerPhase = 32;
+
+    /**
+     Designs the filter and sizes the buffers. Not real time safe.
+
+     @param _factor How many output samples to make for each input sample
+     @param maxInputSamples The most input samples that will be given to process at once
+     @param _numChannels The number of channels to upsample
+     */
+    void prepare (int _factor, int maxInputSamples, int _numChannels)
+    {
+        factor = _factor;
+        numChannels = _numChannels;
+
+        // The last tap is left at zero so that the filter has a whole number of samples of delay.
+        int length = factor * tapsPerPhase;
+        double centre = (length - 2) / 2.0;
+        double cutoff = 0.45 / factor;
+
+        phases.assign ((size_t) length, 0.0f);
+        for (int i = 0; i < length - 1; i++)
+        {
+            double x = i - centre;
+            double sinc = x == 0.0 ? 2.0 * cutoff : std::sin (juce::MathConstants<double>::twoPi * cutoff * x) / (juce::MathConstants<double>::pi * x);
+            double w = juce::MathConstants<double>::twoPi * i / (length - 2);
+            double blackman = 0.42 - (0.5 * std::cos (w)) + (0.08 * std::cos (2.0 * w));
+
+            // Stored phase by phase, and scaled by the factor to make up for the energy spread over the new samples
+            int phase = i % factor;
+            int tap = i / factor;
+            phases[(size_t) ((phase * tapsPerPhase) + tap)] = float (sinc * blackman * factor);
+        }
+
+        historySize = tapsPerPhase - 1 + maxInputSamples;
+        history.assign ((size_t) (historySize * numChannels), 0.0f);
+    }
+
+    void reset()
+    {
+        std::fill (history.begin(), history.end(), 0.0f);
+    }
+
+    /**
+     @return The delay of the filter in output samples
+     */
+    int getLatency() const
+    {
+        return ((factor * tapsPerPhase) - 2) / 2;
+    }
+
+    /**
+     Upsamples one channel.
+
+     @param channel Which channel's history to use
+     @param input The input samples
+     @param numInput The number of input samples, no more than given to prepare
+     @param output Where to write numInput * factor samples
+     */
+    void process (int channel, const float* input, int numInput, float* output)
+    {
+        float* channelHistory = history.data() + (channel * historySize);
+        constexpr int numOld = tapsPerPhase - 1;
+
+        std::copy (input, input + numInput, channelHistory + numOld);
+
+        for (int n = 0; n < numInput; n++)
+        {
+            // The newest sample is at n + numOld, so the taps run backwards through the history from there
+            const float* newest = channelHistory + n + numOld;
+
+            for (int phase = 0; phase < factor; phase++)
+            {
+                const float* taps = phases.data() + (phase * tapsPerPhase);
+                float sum = 0.0f;
+                for (int tap = 0; tap < tapsPerPhase; tap++)
+                    sum += taps[tap] * newest[-tap];
+                output[(n * factor) + phase] = sum;
+            }
+        }
+
+        std::copy (channelHistory + numInput, channelHistory + numInput + numOld, channelHistory);
+    }
+
+private:
+    int factor = 1;
+    int numChannels = 0;
+
+    std::vector<float> phases;
+    std::vector<float> history;
+    int historySize = 0;
+};
+
+//==============================================================================
+class MyEngineRate
+{
+public:
+    /**
+     Works out the engine rate and sizes everything for it. Not real time safe.
+
+     @param _hostRate The host's sample rate
+     @param reduceRate True to run the engine below the host rate where possible
+     @param maxHostSamples The most samples the host will ask for at once
+     @param _numChannels The number of output channels
+     */
+    void prepare (double _hostRate, bool reduceRate, int maxHostSamples, int _numChannels)
+    {
+        hostRate = _hostRate;
+        numChannels = _numChannels;
+        factor = 1;
+
+        if (reduceRate)
+        {
+            while (factor < maxFactor && hostRate / (factor * 2) >= minEngineRate)
+                factor *= 2;
+        }
+
+        numCarried = 0;
+
+        if (factor == 1)
+            return;
+
+        // One more than needed for a full block, as rendering rounds up
+        int maxEngineSamples = (maxHostSamples / factor) + 2;
+        engineBuffer.setSize (numChannels, maxEngineSamples);
+        upsampledBuffer.setSize (numChannels, maxEngineSamples * factor);
+        carryBuffer.setSize (numChannels, factor);
+        engineMidi.ensureSize (2048);
+        heldMidi.ensureSize (2048);
+        heldMidi.clear();
+
+        upsampler.prepare (factor, maxEngineSamples, numChannels);
+    }
+
+    double getEngineRate() const
+    {
+        return hostRate / factor;
+    }
+
+    /**
+     @return The latency in host samples
+     */
+    int getLatency() const
+    {
+        return factor == 1 ? 0 : upsampler.getLatency();
+    }
+
+    /**
+     Renders the engine for a host block.
+
+     @param hostBuffer The buffer to write the upsampled engine output to
+     @param hostMidi The MIDI events for the host block
+     @param numSamples The number of host samples to produce
+     @param renderEngine Called with a buffer, its MIDI and a number of samples to render at the engine rate
+     */
+    template <typename RenderFunction>
+    void render (juce::AudioBuffer<float>& hostBuffer, const juce::MidiBuffer& hostMidi, int numSamples, RenderFunction&& renderEngine)
+    {
+        if (factor == 1)
+        {
+            renderEngine (hostBuffer, hostMidi, numSamples);
+            return;
+        }
+
+        int channelsToWrite = std::min (numChannels, hostBuffer.getNumChannels());
+
+        // Start with anything left over from the last block
+        int fromCarry = std::min (numCarried, numSamples);
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            float* carry = carryBuffer.getWritePointer (channel);
+            if (channel < channelsToWrite)
+                hostBuffer.copyFrom (channel, 0, carry, fromCarry);
+            std::copy (carry + fromCarry, carry + numCarried, carry);
+        }
+        numCarried -= fromCarry;
+
+        // If the carried samples cover the whole block, rendering now would only carry more, so the MIDI waits
+        int needed = numSamples - fromCarry;
+        if (needed <= 0)
+        {
+            for (const auto metadata : hostMidi)
+                heldMidi.addEvent (metadata.data, metadata.numBytes, 0);
+            return;
+        }
+
+        int numEngineSamples = (needed + factor - 1) / factor;
+
+        engineMidi.clear();
+        for (const auto metadata : heldMidi)
+            engineMidi.addEvent (metadata.data, metadata.numBytes, 0);
+        heldMidi.clear();
+
+        for (const auto metadata : hostMidi)
+        {
+            int enginePosition = juce::jlimit (0, numEngineSamples - 1, (metadata.samplePosition - fromCarry) / factor);
+            engineMidi.addEvent (metadata.data, metadata.numBytes, enginePosition);
+        }
+
+        engineBuffer.clear (0, numEngineSamples);
+        renderEngine (engineBuffer, engineMidi, numEngineSamples);
+
+        int numUpsampled = numEngineSamples * factor;
+        int numSpare = numUpsampled - needed;
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            float* upsampled = upsampledBuffer.getWritePointer (channel);
+            upsampler.process (channel, engineBuffer.getReadPointer (channel), numEngineSamples, upsampled);
+
+            if (channel < channelsToWrite)
+                hostBuffer.copyFrom (channel, fromCarry, upsampled, needed);
+
+            std::copy (upsampled + needed, upsampled + numUpsampled, carryBuffer.getWritePointer (channel) + numCarried);
+        }
+        numCarried += numSpare;
+        jassert (numCarried < factor);
+    }
+
+private:
+    static constexpr int maxFactor = 4;
+    static constexpr double minEngineRate = 44100.0;
+
+    double hostRate = 44100.0;
+    int factor = 1;
+    int numChannels = 2;
+
+    MyUpsampler upsampler;
+    juce::AudioBuffer<float> engineBuffer;
+    juce::AudioBuffer<float> upsampledBuffer;
+    juce::MidiBuffer engineMidi;
+
+    // MIDI events from blocks that rendered nothing, for the start of the next render
+    juce::MidiBuffer heldMidi;
+
+    // Host samples already rendered but not yet output. Only rendering adds to these, and it is only done once they
+    // have all been output, so there are always fewer than factor.
+    juce::AudioBuffer<float> carryBuffer;
+    int numCarried = 0;
+};
@@ -0,0 +1,331 @@
+/*
+  ==============================================================================
+
+    MyEnvelope.h
+
+    This implements an ADSR envelope that renders a block at a time instead of
+    a sample at a time like juce::ADSR. It is used for the amp, filter and
+    noise envelopes.
+
+    Each stage is a segment with a known length, worked out when the stage is
+    entered. Rendering a block just fills whole runs of each segment, so there
+    is no check on the stage inside the loops, and getSamplesUntilNextStage
+    lets callers know how long the current segment will last so they can
+    split their own blocks at the stage changes.
+
+    Two curves are available:
+
+    * Linear: Matches juce::ADSR, with each stage a straight ramp.
+    * Exponential: Each stage approaches a target slightly beyond its end
+      value, like an analogue envelope. The curve is calculated
+      multiplicatively from a table of powers of the stage's coefficient so
+      each run is a single multiply and add per sample, with no dependency
+      between samples.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <climits>
+#include <cmath>
+#include <JuceHeader.h>
+
+class MyEnvelope
+{
+public:
+    /// The largest block that the power tables cover. Longer runs are simply split up.
+    static constexpr int maxBlockSize = 64;
+
+    enum class Curve
+    {
+        linear,
+        exponential
+    };
+
+    struct Parameters
+    {
+        float attack = 0.1f;
+        float decay = 0.1f;
+        float sustain = 1.0f;
+        float release = 0.1f;
+    };
+
+    /**
+     @param sampleRate The current sample rate, the stage lengths are recalculated
+     */
+    void setSampleRate (double _sampleRate)
+    {
+        sampleRate = _sampleRate;
+        recalculateSegments();
+    }
+
+    /**
+     Sets the stage times and sustain level. A stage that is in progress carries on from its current value.
+
+     @param _params The new times in seconds and the sustain level
+     @param _curve The shape of the stages
+     */
+    void setParameters (const Parameters& _params, Curve _curve)
+    {
+        params = _params;
+        curve = _curve;
+        recalculateSegments();
+    }
+
+    void reset()
+    {
+        value = 0.0f;
+        enterStage (Stage::idle);
+    }
+
+    void noteOn()
+    {
+        enterStage (Stage::attack);
+    }
+
+    void noteOff()
+    {
+        if (stage != Stage::idle)
+            enterStage (Stage::release);
+    }
+
+    bool isActive() const
+    {
+        return stage != Stage::idle;
+    }
+
+    /**
+     @return The last value rendered
+     */
+    float getValue() const
+    {
+        return value;
+    }
+
+    /**
+     @return The number of samples before the envelope moves to its next stage, or INT_MAX if it is sustaining or idle
+     */
+    int getSamplesUntilNextStage() const
+    {
+        return samplesLeft;
+    }
+
+    /**
+     Renders the envelope for a block.
+
+     @param output Where to write the envelope values
+     @param numSamples The number of values to write
+     */
+    void renderBlock (float* output, int numSamples)
+    {
+        while (numSamples > 0)
+        {
+            int runLength = std::min (numSamples, samplesLeft);
+
+            switch (stage)
+            {
+                case Stage::idle:
+                case Stage::sustain:
+                    juce::FloatVectorOperations::fill (output, value, runLength);
+                    break;
+                default:
+                    runLength = std::min (runLength, maxBlockSize);
+                    renderSegment (segments[int (stage)], output, runLength);
+            }
+
+            output += runLength;
+            numSamples -= runLength;
+
+            if (samplesLeft != INT_MAX)
+            {
+                samplesLeft -= runLength;
+                if (samplesLeft == 0)
+                    finishStage();
+            }
+        }
+    }
+
+private:
+    enum class Stage
+    {
+        idle,
+        attack,
+        decay,
+        sustain,
+        release
+    };
+
+    /**
+     The shape of one stage. For linear curves only the step is used. For exponential curves the value approaches the
+     target with powers[i] holding coefficient^(i + 1).
+     */
+    struct Segment
+    {
+        float step = 0.0f;
+        float target = 0.0f;
+        double coefficient = 1.0;
+        float powers[maxBlockSize];
+    };
+
+    // How far beyond the end of each exponential stage the curve aims. Smaller values give sharper curves.
+    static constexpr float attackOvershoot = 0.3f;
+    static constexpr float decayReleaseOvershoot = 0.0001f;
+
+    double sampleRate = 44100.0;
+    Parameters params;
+    Curve curve = Curve::linear;
+
+    Stage stage = Stage::idle;
+    float value = 0.0f;
+    int samplesLeft = INT_MAX;
+
+    // Indexed by Stage, only the attack, decay and release entries are used.
+    Segment segments[5];
+
+    void renderSegment (const Segment& segment, float* output, int runLength)
+    {
+        if (curve == Curve::linear)
+        {
+            for (int i = 0; i < runLength; i++)
+                output[i] = value + (segment.step * float (i + 1));
+        }
+        else
+        {
+            float distance = value - segment.target;
+            for (int i = 0; i < runLength; i++)
+                output[i] = segment.target + (distance * segment.powers[i]);
+        }
+
+        value = output[runLength - 1];
+    }
+
+    /**
+     Snaps the value to the exact end of the current stage and moves on to the next one.
+     */
+    void finishStage()
+    {
+        switch (stage)
+        {
+            case Stage::attack:
+                value = 1.0f;
+                enterStage (Stage::decay);
+                break;
+            case Stage::decay:
+                value = params.sustain;
+                enterStage (Stage::sustain);
+                break;
+            case Stage::release:
+                value = 0.0f;
+                enterStage (Stage::idle);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     Starts a stage from the current value, working out how many samples it will last. Zero length stages are skipped
+     straight over, as juce::ADSR does.
+     */
+    void enterStage (Stage newStage)
+    {
+        stage = newStage;
+
+        switch (stage)
+        {
+            case Stage::idle:
+                samplesLeft = INT_MAX;
+                return;
+            case Stage::sustain:
+                samplesLeft = INT_MAX;
+                return;
+            case Stage::attack:
+                samplesLeft = getSegmentLength (params.attack, value, 1.0f);
+                break;
+            case Stage::decay:
+                samplesLeft = getSegmentLength (params.decay, value, params.sustain);
+                break;
+            case Stage::release:
+                if (curve == Curve::linear)
+                    segments[int (Stage::release)].step = -value / float (std::max (1.0, params.release * sampleRate));
+                samplesLeft = getSegmentLength (params.release, value, 0.0f);
+                break;
+        }
+
+        if (samplesLeft == 0)
+            finishStage();
+    }
+
+    /**
+     Works out how many samples the current stage will take to get from its start value to its end value.
+     */
+    int getSegmentLength (float time, float startValue, float endValue) const
+    {
+        if (time <= 0.0f || startValue == endValue)
+            return 0;
+
+        const Segment& segment = segments[int (stage)];
+        double length;
+
+        if (curve == Curve::linear)
+        {
+            length = (endValue - startValue) / segment.step;
+        }
+        else
+        {
+            // A coefficient this close to one never gets anywhere, such as the noise envelope's infinite decay.
+            if (segment.coefficient >= 1.0)
+                return INT_MAX;
+
+            double remaining = double (endValue - segment.target) / double (startValue - segment.target);
+            if (remaining <= 0.0)
+                return 0;
+
+            length = std::log (remaining) / std::log (segment.coefficient);
+        }
+
+        if (length <= 0.0)
+            return 0;
+
+        return int (std::min (std::ceil (length), double (INT_MAX - 1)));
+    }
+
+    /**
+     Recalculates the shape of the stages after the parameters or sample rate change. The current stage keeps its
+     value but its remaining length is worked out again.
+     */
+    void recalculateSegments()
+    {
+        double attackSamples = params.attack * sampleRate;
+        double decaySamples = params.decay * sampleRate;
+        double releaseSamples = params.release * sampleRate;
+
+        // Linear steps, matching juce::ADSR. The release step depends on the level at note off so is set then.
+        segments[int (Stage::attack)].step = float (1.0 / std::max (1.0, attackSamples));
+        segments[int (Stage::decay)].step = float (-(1.0 - params.sustain) / std::max (1.0, decaySamples));
+
+        setExponential (segments[int (Stage::attack)], attackSamples, 1.0f + attackOvershoot, attackOvershoot);
+        setExponential (segments[int (Stage::decay)], decaySamples, params.sustain - decayReleaseOvershoot, decayReleaseOvershoot);
+        setExponential (segments[int (Stage::release)], releaseSamples, -decayReleaseOvershoot, decayReleaseOvershoot);
+
+        if (stage != Stage::idle && stage != Stage::sustain)
+            enterStage (stage);
+    }
+
+    /**
+     Sets an exponential segment up so that it covers the full range from 0 to 1 in the given number of samples.
+     */
+    static void setExponential (Segment& segment, double numSamples, float target, float overshoot)
+    {
+        segment.target = target;
+        segment.coefficient = std::exp (-std::log ((1.0 + overshoot) / overshoot) / std::max (1.0, numSamples));
+
+        double power = 1.0;
+        for (int i = 0; i < maxBlockSize; i++)
+        {
+            power *= segment.coefficient;
+            segment.powers[i] = float (power);
+        }
+    }
+};
@@ -5,8 +5,10 @@
     Created: Apr/May 2022
     Author: B191392
 
-    This is a wrapper around the Juce provided filter and ADSR envelope classes
-    to provide a filter section for the synth.
+    This is a wrapper around the Juce provided filter class and MyEnvelope to
+    provide a filter section for the synth. When the filter is bypassed the
+    voice skips it entirely, envelope included, so the envelope carries on from
+    where it was left if the filter is switched back on mid note.
  
     The following parameters are used in this class:
  
@@ -19,6 +21,10 @@
     * filterDecay: Specifies the time for the filter to ramp down to the sustain value
     * filterSustain: Specifies the level the filter will remain at after decay and before release
     * filterRelease: Specifies the time for the filter to ramp down fulls after the note stops
+    * filterCurve: Whether the envelope stages are linear or exponential
+
+    The coefficients only follow the envelope and LFO every few samples, at the
+    control interval set by the quality mode.
 
  
   ==============================================================================
@@ -26,6 +32,8 @@
 
 #pragma once
 
+#include "MyArena.h"
+#include "MyEnvelope.h"
 #include "MyParameters.h"
 #include <JuceHeader.h>
 
@@ -37,11 +45,23 @@ public:
      
      @param _params A pointer to the user editable parameters.
      */
-    MyFilter (MyParameters* _params) : params (_params)
+    MyFilter (MyParameters* _params) :
+    params (_params),
+    envWatcher (_params, { "filter_attack", "filter_decay", "filter_sustain", "filter_release", "filter_curve" })
     {
         // empty
     }
 
+    /**
+     Takes the envelope buffer from the arena. Called from the arena's layout function.
+
+     @param arena The arena being laid out
+     */
+    void allocate (MyArena& arena)
+    {
+        envBuffer = arena.allocate<float> (MyEnvelope::maxBlockSize);
+    }
+
     /**
             Resets the filter when a new note is started. Must be called at the start of notes or else the filter will not work and could cause silence.
      */
@@ -51,6 +71,8 @@ public:
 
         filterEnv.reset();
         filterEnv.noteOn();
+
+        controlCountdown = 0;
     }
 
     /**
@@ -63,23 +85,48 @@ public:
 
     
     /**
-     Applies the filter to the given sample if the filter is turned on, otherwise returns the given sample untouched.
-     
-            This function also contains handling for the LFO which can be applied to the frequency or the resonance values. See updateParams for more.
+     Applies the filter to a block of samples in place.
+
+            The filter type and what the envelope applies to are read once for the block and used to pick a specialised loop.
+            The LFO routing is given as template parameters by the voice for the same reason. See renderBlockWith for more.
 
+     @param buffer The samples to apply the filter to
+     @param numSamples The number of samples in the buffer
      @param sampleRate The current sample rate, needed for correctly setting up the filter coefficients
-     @param sample The sample to apply the filter to
-     @param lfoAppliesToFilterFreq Specifies whether the LFO should be applied to the frequency
-     @param lfoAppliesToFilterQ Specifies whether the LFO should be applied to the resonance
-     @param lfoSample The relevant sample generated by the LFO
+     @param lfoBuffer The LFO samples for this block, only read if the LFO applies to the filter
      */
-    float apply (float sampleRate, float sample, bool lfoAppliesToFilterFreq, bool lfoAppliesToFilterQ, float lfoSample)
+    template <bool lfoAppliesToFilterFreq, bool lfoAppliesToFilterQ>
+    void renderBlock (float* buffer, int numSamples, float sampleRate, const float* lfoBuffer)
     {
-        updateParams (sampleRate, lfoAppliesToFilterFreq, lfoAppliesToFilterQ, lfoSample);
-        if (params->filterOn->get())
-            return filter.processSingleSampleRaw (sample);
+        bool highPass = int (*params->filterType) == 1;
+
+        updateEnvelopeParams (sampleRate);
+
+        // The cached coefficients are no longer valid if anything other than the frequency and Q has changed.
+        if (highPass != lastHighPass || sampleRate != lastSampleRate)
+        {
+            lastHighPass = highPass;
+            lastSampleRate = sampleRate;
+            lastFreq = -1.0f;
+        }
+
+        bool envAppliesToQ = params->filterAppliesTo->getIndex() == 1;
+        controlInterval = params->quality.getSettings().controlInterval;
+
+        if (highPass)
+        {
+            if (envAppliesToQ)
+                renderBlockWith<true, true, lfoAppliesToFilterFreq, lfoAppliesToFilterQ> (buffer, numSamples, sampleRate, lfoBuffer);
+            else
+                renderBlockWith<true, false, lfoAppliesToFilterFreq, lfoAppliesToFilterQ> (buffer, numSamples, sampleRate, lfoBuffer);
+        }
         else
-            return sample;
+        {
+            if (envAppliesToQ)
+                renderBlockWith<false, true, lfoAppliesToFilterFreq, lfoAppliesToFilterQ> (buffer, numSamples, sampleRate, lfoBuffer);
+            else
+                renderBlockWith<false, false, lfoAppliesToFilterFreq, lfoAppliesToFilterQ> (buffer, numSamples, sampleRate, lfoBuffer);
+        }
     }
 
 private:
@@ -87,120 +134,136 @@ private:
 
     juce::IIRFilter filter;
 
-    juce::ADSR filterEnv;
-    juce::ADSR::Parameters filterParams;
+    MyEnvelope filterEnv;
+    MyEnvelope::Parameters filterParams;
+    float* envBuffer = nullptr;
+
+    MyParameterWatcher envWatcher;
+    float lastEnvSampleRate = 0.0f;
+
+    // The settings the current coefficients were made with, so they are only recalculated when these change.
+    bool lastHighPass = false;
+    float lastSampleRate = 0.0f;
+    float lastFreq = -1.0f;
+    float lastQ = -1.0f;
+
+    // How often the modulated coefficients are recalculated, and how many samples until they next are.
+    int controlInterval = 1;
+    int controlCountdown = 0;
 
     /**
-     Updates the parameters of the filter based on the user params object and the LFO.
-        
-     @param sampleRate The current sample rate, needed for correctly setting up the filter coefficients
-     @param lfoAppliesToFilterFreq Specifies whether the LFO should be applied to the frequency
-     @param lfoAppliesToFilterQ Specifies whether the LFO should be applied to the resonance
-     @param lfoSample The relevant sample generated by the LFO
+     Sets the filter envelope up from the user editable parameters, but only if they or the sample rate have changed.
+
+     @param sampleRate The current sample rate
      */
-    void updateParams (float sampleRate, bool lfoAppliesToFilterFreq, bool lfoAppliesToFilterQ, float lfoSample)
+    void updateEnvelopeParams (float sampleRate)
     {
-        // Setting the filter parameters from the user editable parameters
+        if (sampleRate != lastEnvSampleRate)
+        {
+            lastEnvSampleRate = sampleRate;
+            envWatcher.forceChanged();
+        }
+
+        if (! envWatcher.hasChanged())
+            return;
+
+        filterEnv.setSampleRate (sampleRate);
         filterParams.attack = *params->filterAttack;
         filterParams.decay = *params->filterDecay;
         filterParams.sustain = *params->filterSustain;
         filterParams.release = *params->filterRelease;
-        filterEnv.setParameters (filterParams);
-        
-        float freq = getFilterFrequency (lfoAppliesToFilterFreq, lfoSample);
-        float q = getFilterQ (lfoAppliesToFilterQ, lfoSample);
+        filterEnv.setParameters (filterParams, MyEnvelope::Curve (params->filterCurve->getIndex()));
+    }
+
+    /**
+     The filter loop for one combination of settings. The coefficients follow the envelope and the LFO every sample but
+     are only recalculated when the resulting frequency or Q actually changes, such as during the sustain.
 
-        float envVal = filterEnv.getNextSample();
+            When the envelope applies to the frequency the low pass is protected against going below 20Hz and the high pass
+            against going beyond 20kHz. When it applies to the Q it is protected against going below 0.01.
+
+     @param buffer The samples to apply the filter to
+     @param numSamples The number of samples in the buffer
+     @param sampleRate The current sample rate, needed for correctly setting up the filter coefficients
+     @param lfoBuffer The LFO samples for this block
+     */
+    template <bool highPass, bool envAppliesToQ, bool lfoAppliesToFilterFreq, bool lfoAppliesToFilterQ>
+    void renderBlockWith (float* buffer, int numSamples, float sampleRate, const float* lfoBuffer)
+    {
+        float userFreq = *params->filterFreq;
+        float userQ = *params->filterQ;
 
-        // Apply the filter to the Q value if that is selected in the user params.
-        if (params->filterAppliesTo->getIndex() == 1)
-            q = std::max (envVal * q, 0.01f);
+        filterEnv.renderBlock (envBuffer, numSamples);
 
-        switch (int (*params->filterType))
+        for (int i = 0; i < numSamples; i++)
         {
-            case 1: setHighPassCoefficients (sampleRate, freq, q, envVal); break;
-            default: setLowPassCoefficients (sampleRate, freq, q, envVal);
+            if (--controlCountdown > 0)
+            {
+                buffer[i] = filter.processSingleSampleRaw (buffer[i]);
+                continue;
+            }
+
+            controlCountdown = controlInterval;
+
+            float freq = userFreq;
+            float q = userQ;
+
+            if constexpr (lfoAppliesToFilterFreq)
+                freq = getFilterFrequency (userFreq, lfoBuffer[i]);
+
+            if constexpr (lfoAppliesToFilterQ)
+                q = getFilterQ (userQ, lfoBuffer[i]);
+
+            float envVal = envBuffer[i];
+
+            if constexpr (envAppliesToQ)
+                q = std::max (envVal * q, 0.01f);
+            else if constexpr (highPass)
+                freq = 20000.0f - (envVal * (20000.0f - freq));
+            else
+                freq = std::max (envVal * freq, 20.0f);
+
+            if (freq != lastFreq || q != lastQ)
+            {
+                lastFreq = freq;
+                lastQ = q;
+
+                if constexpr (highPass)
+                    filter.setCoefficients (juce::IIRCoefficients::makeHighPass (sampleRate, freq, q));
+                else
+                    filter.setCoefficients (juce::IIRCoefficients::makeLowPass (sampleRate, freq, q));
+            }
+
+            buffer[i] = filter.processSingleSampleRaw (buffer[i]);
         }
     }
 
     /**
-     Gets the filter frequency from the user params and applies the LFO if necessary.
+     Applies the LFO to the filter frequency.
      
      The LFO is applied by first finding the minimum distance from the intended frequency and 20Hz and 20kHz. This is
      the maximum allowable difference that we can swing the frequency value by so the LFO is mutiplied by this value
      and added to the selected frequency.
 
-     @param applyLfo Whether to apply the LFO here.
+     @param freq The user selected frequency
      @param lfoSample The relevant sample generated by the LFO
      */
-    float getFilterFrequency (bool applyLfo, float lfoSample)
+    static float getFilterFrequency (float freq, float lfoSample)
     {
-        float freq = *params->filterFreq;
-
-        if (applyLfo)
-        {
-            float maxAllowedDiff = std::min (std::fabs (freq - 20.0f), std::fabs (20000.0f - freq));
-            return freq + (lfoSample * maxAllowedDiff);
-        }
-        else
-        {
-            return freq;
-        }
+        float maxAllowedDiff = std::min (std::fabs (freq - 20.0f), std::fabs (20000.0f - freq));
+        return freq + (lfoSample * maxAllowedDiff);
     }
 
     /**
-     Gets the filter resonance value from the user params and applies the LFO if necessary.
+     Applies the LFO to the filter resonance value.
      
      The LFO will simply cause the Q value to swing between 0 and twice the user setting.
      
-     @param applyLfo Whether to apply the LFO here.
+     @param q The user selected resonance
      @param lfoSample The relevant sample generated by the LFO
      */
-    float getFilterQ (bool applyLfo, float lfoSample)
+    static float getFilterQ (float q, float lfoSample)
     {
-        float q = *params->filterQ;
-
-        if (applyLfo)
-        {
-            return q + (lfoSample * q);
-        }
-        else
-        {
-            return q;
-        }
-    }
-
-    /**
-     Sets the filter up with low pass coefficients.
-     
-     @param sampleRate The current sample rate, needed for correctly setting up the filter coefficients
-     @param freq Specifies the frequency to set the filter at
-     @param q Specifies the resonance to set the filter at
-     @param envVal The relevant modifier value generated by the envelope
-     */
-    void setLowPassCoefficients (float& sampleRate, float& freq, float& q, float& envVal)
-    {
-        // Protection against going below 20Hz
-        if (params->filterAppliesTo->getIndex() == 0)
-            freq = std::max (envVal * freq, 20.0f);
-
-        filter.setCoefficients (juce::IIRCoefficients::makeLowPass (sampleRate, freq, q));
-    }
-
-    /**
-     Sets the filter up with high pass coefficients.
-     
-     @param sampleRate The current sample rate, needed for correctly setting up the filter coefficients
-     @param freq Specifies the frequency to set the filter at
-     @param q Specifies the resonance to set the filter at
-     @param envVal The relevant modifier value generated by the envelope
-     */
-void setHighPassCoefficients (float& sampleRate, float& freq, float& q, float& envVal)
-    {
-        // Protection against going beyond 20kHz
-        if (params->filterAppliesTo->getIndex() == 0)
-            freq = 20000.0f - (envVal * (20000.0f - freq));
-
-        filter.setCoefficients (juce::IIRCoefficients::makeHighPass (sampleRate, freq, q));
+        return q + (lfoSample * q);
     }
 };
@@ -0,0 +1,104 @@
+/*
+  ==============================================================================
+
+    MyGovernor.h
+
+    This implements the optional CPU governor. The processor times every
+    processBlock call against the block's real time duration and passes the
+    load in here. When the worst load over the last 32 blocks goes over the
+    quality mode's budget the governor steps up a level, each of which gives
+    up some quality to save CPU (see MyQuality::update):
+
+    1. Filter coefficients are recalculated 4 times less often
+    2. Unison is capped at 4 and the oscillators stop oversampling
+    3. At most 4 voices can be releasing, the quietest tails fade out over 5ms
+
+    After a change the load history is cleared so the next decision is based
+    on the load at the new level. Levels are given back one at a time, and
+    only once the load has stayed under 70% of the budget for 2 seconds, so
+    that the quality does not flap up and down around the threshold.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+
+class MyGovernor
+{
+public:
+    static constexpr int maxLevel = 3;
+
+    /**
+     Updates the level from the time the last block took. Called by the processor at the end of every block.
+
+     @param enabled True if the governor is turned on
+     @param processSeconds How long the block took to process
+     @param blockSeconds How long the block lasts in real time
+     @param budget The share of blockSeconds the processing should stay within, or 0 for no limit
+     */
+    void update (bool enabled, double processSeconds, double blockSeconds, float budget)
+    {
+        if (! enabled || budget <= 0.0f || blockSeconds <= 0.0)
+        {
+            if (level != 0)
+                changeLevel (0);
+            return;
+        }
+
+        history[historyIndex] = float (processSeconds / blockSeconds);
+        historyIndex = (historyIndex + 1) % historySize;
+        numBlocksSinceChange++;
+
+        float worstLoad = *std::max_element (history, history + historySize);
+
+        if (worstLoad > budget)
+        {
+            calmSeconds = 0.0;
+
+            if (level < maxLevel && numBlocksSinceChange >= raiseDelayBlocks)
+                changeLevel (level + 1);
+        }
+        else if (worstLoad < budget * restoreFraction)
+        {
+            calmSeconds += blockSeconds;
+
+            if (level > 0 && calmSeconds >= restoreSeconds)
+                changeLevel (level - 1);
+        }
+        else
+        {
+            calmSeconds = 0.0;
+        }
+    }
+
+    /**
+     @return How many steps of quality are currently given up, from 0 to maxLevel
+     */
+    int getLevel() const
+    {
+        return level;
+    }
+
+private:
+    static constexpr int historySize = 32;
+    static constexpr int raiseDelayBlocks = 8;
+    static constexpr float restoreFraction = 0.7f;
+    static constexpr double restoreSeconds = 2.0;
+
+    float history[historySize] = {};
+    int historyIndex = 0;
+    int numBlocksSinceChange = 0;
+    double calmSeconds = 0.0;
+
+    int level = 0;
+
+    void changeLevel (int newLevel)
+    {
+        level = newLevel;
+        std::fill (history, history + historySize, 0.0f);
+        numBlocksSinceChange = 0;
+        calmSeconds = 0.0;
+    }
+};
@@ -0,0 +1,155 @@
+/*
+  ==============================================================================
+
+    MyHalfBand.h
+
+    A half-band FIR filter for halving or doubling the sample rate of one
+    channel, used to run the Eco reverb below the host rate (MyReverb.h).
+    Stages can be chained for a quarter of the rate.
+
+    A half-band low pass cuts off at a quarter of the higher rate, and every
+    other tap apart from the centre one is zero. Together with the filter
+    being symmetric, this means each output sample takes 12 multiplies for
+    the 47 tap filter. The taps are a Blackman windowed sinc, giving around
+    70dB of rejection above 0.31 of the higher rate.
+
+    Decimation keeps its place between calls, so blocks of any length can be
+    given to it and it returns how many samples it made. Interpolation always
+    makes two samples for each one given.
+
+    Both directions delay the signal by 23 samples at the higher rate. The
+    histories live in the processor's arena (MyArena.h).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "MyArena.h"
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+
+class MyHalfBand
+{
+public:
+    /// The length of the filter at the higher rate
+    static constexpr int numTaps = 47;
+
+    /// The number of non zero taps either side of the centre
+    static constexpr int numSideTaps = (numTaps + 1) / 4;
+
+    MyHalfBand()
+    {
+        // Only the even taps are non zero apart from the centre one, which is always a half
+        constexpr int centre = (numTaps - 1) / 2;
+        float sum = 0.0f;
+        for (int j = 0; j < numSideTaps; j++)
+        {
+            int i = 2 * j;
+            double x = (i - centre) / 2.0;
+            double sinc = std::sin (juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+            double w = juce::MathConstants<double>::twoPi * i / (numTaps - 1);
+            double blackman = 0.42 - (0.5 * std::cos (w)) + (0.08 * std::cos (2.0 * w));
+            sideTaps[j] = float (0.5 * sinc * blackman);
+            sum += 2.0f * sideTaps[j];
+        }
+
+        // Scaled so that DC passes at unity
+        for (float& tap : sideTaps)
+            tap *= 0.5f / sum;
+    }
+
+    /**
+     Takes the histories from the arena. Called from the arena's layout function.
+
+     @param arena The arena being laid out
+     @param _maxInputSamples The most samples that will be given to decimate or interpolate at once
+     */
+    void allocate (MyArena& arena, int _maxInputSamples)
+    {
+        maxInputSamples = _maxInputSamples;
+        decimateHistory = arena.allocate<float> ((size_t) (decimateOld + maxInputSamples));
+        interpolateHistory = arena.allocate<float> ((size_t) (interpolateOld + maxInputSamples));
+    }
+
+    void reset()
+    {
+        std::fill (decimateHistory, decimateHistory + decimateOld, 0.0f);
+        std::fill (interpolateHistory, interpolateHistory + interpolateOld, 0.0f);
+        phase = 0;
+    }
+
+    /**
+     Halves the rate of a run of samples.
+
+     @param input The samples at the higher rate
+     @param numInput The number of input samples, no more than given to allocate
+     @param output Where to write the samples at the lower rate, which needs room for numInput / 2 + 1
+     @return The number of samples written to output
+     */
+    int decimate (const float* input, int numInput, float* output)
+    {
+        jassert (numInput <= maxInputSamples);
+        std::copy (input, input + numInput, decimateHistory + decimateOld);
+
+        constexpr int centre = (numTaps - 1) / 2;
+        int numOutput = 0;
+        for (int n = phase; n < numInput; n += 2)
+        {
+            // The taps run backwards through the history from the newest sample, pairing up either end of the filter
+            const float* newest = decimateHistory + decimateOld + n;
+            float sum = 0.5f * newest[-centre];
+            for (int j = 0; j < numSideTaps; j++)
+                sum += sideTaps[j] * (newest[-2 * j] + newest[(2 * j) - (numTaps - 1)]);
+            output[numOutput++] = sum;
+        }
+
+        phase = (phase + numInput) & 1;
+        std::copy (decimateHistory + numInput, decimateHistory + numInput + decimateOld, decimateHistory);
+
+        return numOutput;
+    }
+
+    /**
+     Doubles the rate of a run of samples.
+
+     @param input The samples at the lower rate
+     @param numInput The number of input samples, no more than given to allocate
+     @param output Where to write numInput * 2 samples at the higher rate
+     */
+    void interpolate (const float* input, int numInput, float* output)
+    {
+        jassert (numInput <= maxInputSamples);
+        std::copy (input, input + numInput, interpolateHistory + interpolateOld);
+
+        for (int n = 0; n < numInput; n++)
+        {
+            // Of the two new samples one only lands on the centre tap, the other on all of the side taps. The taps are
+            // doubled to make up for the zeros between the input samples.
+            const float* newest = interpolateHistory + interpolateOld + n;
+            float sum = 0.0f;
+            for (int j = 0; j < numSideTaps; j++)
+                sum += sideTaps[j] * (newest[-j] + newest[j - interpolateOld]);
+
+            output[2 * n] = 2.0f * sum;
+            output[(2 * n) + 1] = newest[-(interpolateOld - 1) / 2];
+        }
+
+        std::copy (interpolateHistory + numInput, interpolateHistory + numInput + interpolateOld, interpolateHistory);
+    }
+
+private:
+    // How many old samples each direction needs
+    static constexpr int decimateOld = numTaps - 1;
+    static constexpr int interpolateOld = (numTaps - 1) / 2;
+
+    float sideTaps[numSideTaps] = {};
+
+    float* decimateHistory = nullptr;
+    float* interpolateHistory = nullptr;
+    int maxInputSamples = 0;
+
+    // Which of the next input samples makes an output sample when decimating, 0 or 1
+    int phase = 0;
+};
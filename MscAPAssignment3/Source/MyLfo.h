@@ -21,7 +21,8 @@
     This also provides a set of appliesTo* functions that can be used to check
     if the LFO should apply to certain parameters. These are provided so that
     the knowledge of which index refers to which choice remains encapsulated
-    within this. 
+    within this. They take the target from getTarget and are constexpr so the
+    voice can pick a render kernel that has the LFO routing built in.
 
   ==============================================================================
 */
@@ -48,48 +49,51 @@ public:
         updatePhaseDelta (*params->lfoFrequency, sampleRate);
     }
 
-    float getNextSample()
+    /**
+     Fills a block with LFO samples. The wave shape is picked once for the whole block.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     */
+    void renderBlock (float* output, int numSamples)
     {
-        float sample;
         switch (int (*params->lfoType))
         {
-            case 0:
-                sample = getNextSampleSine();
-                break;
-            case 1:
-                sample = getNextSampleTriangle();
-                break;
-            case 2:
-                sample = getNextSampleSquare();
-                break;
-            case 3:
-                sample = getNextSampleSaw();
-                break;
-            case 4:
-                sample = getNextSampleInvertedSaw();
-                break;
-            default:
-                sample = getNextSampleTriangle();
+            case 0: renderShape (output, numSamples, [this] { return getNextSampleSine(); }); break;
+            case 1: renderShape (output, numSamples, [this] { return getNextSampleTriangle(); }); break;
+            case 2: renderShape (output, numSamples, [this] { return getNextSampleSquare(); }); break;
+            case 3: renderShape (output, numSamples, [this] { return getNextSampleSaw(); }); break;
+            case 4: renderShape (output, numSamples, [this] { return getNextSampleInvertedSaw(); }); break;
+            default: renderShape (output, numSamples, [this] { return getNextSampleTriangle(); });
         }
 
-        return *params->lfoDepth * sample;
+        juce::FloatVectorOperations::multiply (output, *params->lfoDepth, numSamples);
     }
 
-    bool appliesToOsc1Frequency() { return appliesTo (0, 4); }
+    /// Target index used when the LFO is switched off.
+    static constexpr int noTarget = 10;
+    static constexpr int numTargets = 11;
+
+    /**
+     @return The lfoAppliesTo index, or noTarget if the LFO is off
+     */
+    int getTarget() { return params->lfoOn->get() ? int (*params->lfoAppliesTo) : noTarget; }
 
-    bool appliesToOsc1Cents() { return appliesTo (1, 5); }
+    static constexpr bool appliesToOsc1Frequency (int target) { return target == 0 || target == 4; }
 
-    bool appliesToOsc2Frequency() { return appliesTo (2, 4); }
+    static constexpr bool appliesToOsc1Cents (int target) { return target == 1 || target == 5; }
 
-    bool appliesToOsc2Cents() { return appliesTo (3, 5); }
+    static constexpr bool appliesToOsc2Frequency (int target) { return target == 2 || target == 4; }
 
-    bool appliesToFilterFrequency() { return appliesTo (6); }
+    static constexpr bool appliesToOsc2Cents (int target) { return target == 3 || target == 5; }
 
-    bool appliesToFilterQ() { return appliesTo (7); }
+    static constexpr bool appliesToFilterFrequency (int target) { return target == 6; }
 
-    bool appliesToAmpVolume() { return appliesTo (8); }
+    static constexpr bool appliesToFilterQ (int target) { return target == 7; }
 
-    bool appliesToAmpDistortion() { return appliesTo (9); }
+    static constexpr bool appliesToAmpVolume (int target) { return target == 8; }
+
+    static constexpr bool appliesToAmpDistortion (int target) { return target == 9; }
 
 private:
     MyParameters* params;
@@ -99,12 +103,11 @@ private:
 
     float pi2 = 2 * M_PI;
 
-    bool appliesTo (int index) { return params->lfoOn->get() && int (*params->lfoAppliesTo) == index; }
-
-    bool appliesTo (int index1, int index2)
+    template <typename ShapeFunction>
+    void renderShape (float* output, int numSamples, ShapeFunction getNextShapeSample)
     {
-        int lfoAppliesTo = int (*params->lfoAppliesTo);
-        return params->lfoOn->get() && (lfoAppliesTo == index1 || lfoAppliesTo == index2);
+        for (int i = 0; i < numSamples; i++)
+            output[i] = getNextShapeSample();
     }
 
     float getNextSampleSine()
@@ -10,31 +10,133 @@
  
     * noiseOn: Whether this should produce something or return 0
     * noiseGain: How loud the noise signal should be
+    * noiseColour: White, pink or brown noise
     * noiseFilter: A simple low pass filter that colours the noise
     * noiseDuration: How long the noise should be
+
+    The white noise comes from MyCounterRandom, which hashes a per voice key
+    with a running sample counter rather than stepping a generator like
+    juce::Random. Every sample in a block is independent of the others so the
+    loop can be vectorised, and since each voice is seeded from its index the
+    output is the same on every render no matter which thread it happens on.
+
+    Pink noise uses the Voss-McCartney algorithm, where each of a set of rows
+    of random values is updated half as often as the one before and they are
+    summed. Brown noise is white noise through a leaky integrator.
  
   ==============================================================================
 */
 
 #pragma once
 
+#include "MyArena.h"
+#include "MyEnvelope.h"
 #include "MyParameters.h"
 #include <JuceHeader.h>
 
+/**
+ Counter based random number generator. Each value is a hash of the key and the position in the stream.
+ */
+class MyCounterRandom
+{
+public:
+    /**
+     Sets the stream up from the start for the given seed.
+
+     @param seed Any value, different seeds give unrelated streams
+     */
+    void setSeed (uint32_t seed)
+    {
+        key = hash (seed ^ 0x9e3779b9u);
+        counter = 0;
+    }
+
+    /**
+     Fills a block with values between -1 and 1.
+
+     @param output Where to write the values
+     @param numSamples The number of values to write
+     */
+    void fillBipolar (float* output, int numSamples)
+    {
+        for (int i = 0; i < numSamples; i++)
+        {
+            // The top 24 bits give every float in [0, 2) with an even spacing.
+            uint32_t bits = hash (key + (counter + uint32_t (i)) * 0x9e3779b9u);
+            output[i] = float (bits >> 8) * (2.0f / 16777216.0f) - 1.0f;
+        }
+
+        counter += uint32_t (numSamples);
+    }
+
+    /**
+     @return The position in the stream, which Voss-McCartney uses to decide which row to update
+     */
+    uint32_t getCounter() const
+    {
+        return counter;
+    }
+
+private:
+    uint32_t key = 0;
+    uint32_t counter = 0;
+
+    /**
+     The lowbias32 integer hash. Only multiplies, shifts and xors so compilers vectorise it.
+     */
+    static uint32_t hash (uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+};
+
 class MyNoiseGenerator
 {
 public:
-    MyNoiseGenerator (MyParameters* _myParams) : params (_myParams)
+    MyNoiseGenerator (MyParameters* _myParams) :
+    params (_myParams),
+    paramWatcher (_myParams, { "noise_filter", "noise_duration" })
     {
         // We fix these values since they are present mostly just to avoid clicks
         noiseEnvParams.attack = 0.01f;
         // Note that the decay is set by user parameters in updateParams
         noiseEnvParams.sustain = 0.0f;
         noiseEnvParams.release = 0.01f;
+
+        resetColour();
+    }
+
+    /**
+     Takes the envelope and noise buffers from the arena. Called from the arena's layout function.
+
+     @param arena The arena being laid out
+     */
+    void allocate (MyArena& arena)
+    {
+        envBuffer = arena.allocate<float> (MyEnvelope::maxBlockSize);
+        noiseBuffer = arena.allocate<float> (MyEnvelope::maxBlockSize);
+        rowBuffer = arena.allocate<float> (MyEnvelope::maxBlockSize);
+    }
+
+    /**
+     Gives the generator its own random stream.
+
+     @param voiceIndex The index of the voice this belongs to
+     */
+    void setSeed (int voiceIndex)
+    {
+        random.setSeed (uint32_t (voiceIndex));
+        rowRandom.setSeed (uint32_t (voiceIndex) + 0x10000u);
     }
 
     void startNote()
     {
+        resetColour();
         noiseFilter.reset();
         noiseEnv.reset();
         noiseEnv.noteOn();
@@ -45,20 +147,54 @@ public:
         noiseEnv.noteOff();
     }
 
-    float getNextSample()
+    /**
+     @return True if the noise would produce silence and can be skipped
+     */
+    bool isSilent()
     {
-        if (! params->noiseOn->get())
-            return 0.0f;
-
-        // Ensure a value between -1 and 1
-        float noiseSample = (random.nextFloat() * 2) - 1;
-        float filteredSample = noiseFilter.processSingleSampleRaw (noiseSample);
-        float envelopedSample = noiseEnv.getNextSample() * filteredSample;
-        return *params->noiseGain * envelopedSample;
+        return ! params->noiseOn->get() || *params->noiseGain <= 0.0f;
+    }
+
+    /**
+     Adds a block of noise to the output. Callers are expected to check isSilent first.
+
+     @param output The buffer to add the noise to
+     @param numSamples The number of samples to add
+     */
+    void addBlock (float* output, int numSamples)
+    {
+        float noiseGain = *params->noiseGain;
+
+        switch (params->noiseColour->getIndex())
+        {
+            case 1: renderPink (noiseBuffer, numSamples); break;
+            case 2: renderBrown (noiseBuffer, numSamples); break;
+            default: random.fillBipolar (noiseBuffer, numSamples);
+        }
+
+        noiseFilter.processSamples (noiseBuffer, numSamples);
+
+        noiseEnv.renderBlock (envBuffer, numSamples);
+        juce::FloatVectorOperations::multiply (noiseBuffer, envBuffer, numSamples);
+        juce::FloatVectorOperations::addWithMultiply (output, noiseBuffer, noiseGain, numSamples);
     }
 
+    /**
+     Updates the filter coefficients and the envelope, but only if the relevant parameters or the sample rate have changed.
+
+     @param sampleRate The current sample rate
+     */
     void updateParams (float sampleRate)
     {
+        if (sampleRate != lastSampleRate)
+        {
+            lastSampleRate = sampleRate;
+            paramWatcher.forceChanged();
+        }
+
+        if (! paramWatcher.hasChanged())
+            return;
+
         float noiseFilterFreq = (*params->noiseFilter * 5000.0f) + 20;
         noiseFilter.setCoefficients (juce::IIRCoefficients::makeLowPass (sampleRate, noiseFilterFreq));
 
@@ -68,14 +204,78 @@ public:
             noiseEnvParams.decay = 10000.0f;
         else
             noiseEnvParams.decay = noiseDurationVal;
-        noiseEnv.setParameters (noiseEnvParams);
+        noiseEnv.setSampleRate (sampleRate);
+        noiseEnv.setParameters (noiseEnvParams, MyEnvelope::Curve::linear);
     }
 
 private:
     MyParameters* params;
 
-    juce::Random random;
+    MyCounterRandom random;
+    MyCounterRandom rowRandom;
     juce::IIRFilter noiseFilter;
-    juce::ADSR noiseEnv;
-    juce::ADSR::Parameters noiseEnvParams;
+    MyEnvelope noiseEnv;
+    MyEnvelope::Parameters noiseEnvParams;
+    float* envBuffer = nullptr;
+    float* noiseBuffer = nullptr;
+    float* rowBuffer = nullptr;
+
+    // Voss-McCartney state for the pink noise
+    static constexpr int numPinkRows = 12;
+    float pinkRows[numPinkRows];
+    float pinkRunningSum;
+
+    // Leaky integrator state for the brown noise
+    float brownLevel;
+
+    MyParameterWatcher paramWatcher;
+    float lastSampleRate = 0.0f;
+
+    void resetColour()
+    {
+        std::fill (pinkRows, pinkRows + numPinkRows, 0.0f);
+        pinkRunningSum = 0.0f;
+        brownLevel = 0.0f;
+    }
+
+    /**
+     Voss-McCartney pink noise. Row k is replaced whenever the counter has k trailing zeros, so it changes every 2^(k+1)
+     samples, and the output is the sum of the rows plus a fresh white sample.
+     */
+    void renderPink (float* output, int numSamples)
+    {
+        uint32_t counter = random.getCounter();
+        random.fillBipolar (output, numSamples);
+        rowRandom.fillBipolar (rowBuffer, numSamples);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            uint32_t position = counter + uint32_t (i) + 1;
+            int row = 0;
+            while ((position & 1) == 0 && row < numPinkRows - 1)
+            {
+                position >>= 1;
+                row++;
+            }
+
+            pinkRunningSum += rowBuffer[i] - pinkRows[row];
+            pinkRows[row] = rowBuffer[i];
+
+            output[i] = (pinkRunningSum + output[i]) * (1.0f / (numPinkRows + 1));
+        }
+    }
+
+    /**
+     Brown noise from integrating white noise, with a small leak so that it does not drift away from zero.
+     */
+    void renderBrown (float* output, int numSamples)
+    {
+        random.fillBipolar (output, numSamples);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            brownLevel = (brownLevel + (0.02f * output[i])) / 1.02f;
+            output[i] = brownLevel * 3.5f;
+        }
+    }
 };
@@ -15,21 +15,87 @@
     * oscOctave: integer value from -2 to 2 that can pitch the oscillator up or down octave values relative to the note frequency
     * oscCents: float value from -100 to 100 that can pitch the oscillator up or down cent values relative to the note frequency
     * oscPush: Only applicable to the Push Square type. See below for more details.
+    * oscUnison: How many detuned copies of the oscillator are played at once, from 1 to 16
+    * oscDetune: How far in cents the outermost unison copies are detuned either side of the note
+    * aliasThreshold: The loudest aliasing in dB that Triangle, Square and Sawtooth may produce, shared by both oscillators
  
     The oscillator has 4 classic types: Sine, Triangle, Square and Sawtooth and two
-    additional special types. Better Sawtooth implements an anti-aliasing technique.
+    additional special types. Better Sawtooth implements an anti-aliasing technique
+    (PolyBLEP).
     The push square type pushes a sine wave through a tanh function with a user
     controllable push value that amplifies the sine wave before pushing it though
     the tanh. This causes a soft clipping to occur at lower push values and
     approaches a slightly rounded square wave at higher push values.
 
+    Samples are rendered a block at a time. The wave shape and whether the LFO
+    modulates the pitch are both decided once per block, so each inner loop is
+    specialised for a single shape with no branching on the parameters.
+
+    Unison is done inside the oscillator rather than with more oscillators. Each
+    unison copy is a lane with its own phase and detune ratio, and the lanes are
+    stepped in groups of four with identical operations on each lane so that a
+    group maps onto one SIMD register. Using Better Sawtooth with a high unison
+    gives a supersaw.
+
+    One oscillator can also be cross modulated by another, which the voice uses
+    for osc2 modulating osc1. Each mode is its own block loop that reads the
+    modulator's block and steps this oscillator in the same pass:
+
+    * Frequency: The modulator scales this oscillator's phase increment (through zero FM)
+    * Phase: The modulator offsets this oscillator's phase
+    * Ring: This oscillator is multiplied by the modulator, with the depth
+      blending between the plain oscillator and the ring modulated one
+    * Sync: This oscillator's phase is reset every time the modulator completes a
+      cycle. The jump this causes is smoothed with the same PolyBLEP correction as
+      Better Sawtooth, at the cost of one sample of delay. The depth is not used.
+
+    The modulator is rendered without its gain, so the modulation only depends
+    on the depth.
+
+    Triangle, Square and Sawtooth pick the cheapest algorithm that keeps their
+    aliasing below the alias threshold: naive, PolyBLEP (not for Triangle,
+    which has no jumps) or 2x oversampled, which renders the PolyBLEP shape at
+    twice the rate. Low notes barely alias so they are rendered naively, and
+    only high notes pay for band limiting. The choice is made when a note
+    starts and again whenever the pitch moves by more than a semitone. Better
+    Sawtooth always uses PolyBLEP, as chosen. The quality mode moves the
+    threshold and can rule out oversampling. When the choice changes part way
+    through a note the oscillator crossfades from the old algorithm to the new
+    one over qualityFadeTime, as they differ slightly in level and the
+    oversampled one is delayed by the decimator.
+
+    These three shapes have no wavetable tier. Their shapes never change, so
+    all a table would save is the PolyBLEP correction, and the tables' levels
+    are an octave apart, so a note at the top of a level loses up to half of
+    its harmonics. That is the dullness the alias threshold is there to trade
+    against, and oversampling already gets below any threshold PolyBLEP
+    cannot.
+
+    Push Square only changes shape when its push does, so once a baked
+    wavetable is available (see MyWavetable.h) it is read from the table
+    instead. This is band limited, so it does not alias at high push values,
+    and replaces the tanh and sin with one lookup. When a new table arrives the
+    oscillator crossfades to it from the old one.
+
+    The Sample type plays back the sample loaded into the synth (see
+    MySampler.h), pitched so that middle C plays it at its original speed. The
+    octave, cents and LFO pitch settings all apply as usual but unison and
+    cross modulation do not.
+
+    FM and phase modulation use a fast polynomial sine instead of std::sin since
+    the carrier phase changes every sample. Unison is not used when cross
+    modulating.
+
   ==============================================================================
 */
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include "MyParameters.h"
+#include "MySampler.h"
+#include "MyWavetable.h"
 
 class MyOscillator
 {
@@ -38,10 +104,22 @@ public:
                   std::atomic<float>* _oscGain,
                   std::atomic<float>* _oscOctave,
                   std::atomic<float>* _oscCents,
-                  std::atomic<float>* _oscPush) :
-    oscType (_oscType), oscGain (_oscGain), oscOctave (_oscOctave), oscCents (_oscCents), oscPush (_oscPush)
+                  std::atomic<float>* _oscPush,
+                  std::atomic<float>* _oscUnison,
+                  std::atomic<float>* _oscDetune,
+                  std::atomic<float>* _aliasThreshold,
+                  const MyQuality* _quality) :
+    oscType (_oscType), oscGain (_oscGain), oscOctave (_oscOctave), oscCents (_oscCents), oscPush (_oscPush),
+    oscUnison (_oscUnison), oscDetune (_oscDetune), aliasThreshold (_aliasThreshold), quality (_quality)
     {
-        // empty
+        // Start the unison lanes spread out over the cycle so they do not all line up when the unison is turned up.
+        for (int lane = 0; lane < maxLanes; lane++)
+        {
+            float position = lane * 0.618034f;
+            lanePhases[lane] = position - std::floor (position);
+            laneRatios[lane] = 1.0f;
+            laneGains[lane] = lane == 0 ? 1.0f : 0.0f;
+        }
     }
 
     
@@ -51,6 +129,35 @@ public:
     void startNote (float _frequency)
     {
         noteFrequency = _frequency;
+
+        // There is nothing to fade from at the start of a note, so the next render just picks up the latest table.
+        bakedTable = nullptr;
+        bakedVersion = 0;
+        fadeFromTable = nullptr;
+
+        // Forces the quality to be chosen again for the new pitch, without a fade from the last note's choice
+        qualityDelta = 0.0f;
+        qualityFadeLength = 0;
+        std::fill (decimatorHistory, decimatorHistory + decimatorTaps - 1, 0.0f);
+
+        if (sampleStream != nullptr && int (*oscType) == sampleType)
+            sampleStream->start();
+    }
+
+    /**
+     @param _pushSquareShape The baked Push Square tables for this oscillator's push parameter
+     */
+    void setBakedShape (MyBakedShape* _pushSquareShape)
+    {
+        pushSquareShape = _pushSquareShape;
+    }
+
+    /**
+     @param _sampleStream The stream the Sample type plays from, owned by the synthesiser's MySampleStreamer
+     */
+    void setSampleStream (MySampleStream* _sampleStream)
+    {
+        sampleStream = _sampleStream;
     }
 
     
@@ -114,34 +221,183 @@ public:
         updatePhaseDelta (actualFrequency, sampleRate);
     }
 
-    float getNextSample()
+    enum class CrossMod
+    {
+        none,
+        frequency,
+        phase,
+        ring,
+        sync
+    };
+
+    /**
+     @return True if the oscillator would produce silence and can be skipped
+     */
+    bool isSilent()
+    {
+        return *oscGain <= 0.0f;
+    }
+
+    /**
+     Renders a block of samples, replacing the contents of output.
+
+     The template parameters state whether the LFO modulates the frequency or the cents. When neither is set the pitch
+     is only calculated once for the whole block.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     @param sampleRate The sample rate of the system
+     @param lfoBuffer The LFO samples for this block, only read if the LFO modulates the pitch
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderBlock (float* output, int numSamples, float sampleRate, const float* lfoBuffer)
     {
-        float sample;
+        renderType<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer);
+        juce::FloatVectorOperations::multiply (output, *oscGain, numSamples);
+    }
+
+    /**
+     Renders a block of this oscillator as the modulator for another one. The gain is not applied, and neither is
+     unison since it is not used when cross modulating.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     @param sampleRate The sample rate of the system
+     @param lfoBuffer The LFO samples for this block, only read if the LFO modulates the pitch
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderModulator (float* output, int numSamples, float sampleRate, const float* lfoBuffer)
+    {
+        unisonAllowed = false;
+        renderType<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer);
+        unisonAllowed = true;
+    }
+
+    /**
+     Renders a block of this oscillator ring modulated by another oscillator's output, without unison.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     @param sampleRate The sample rate of the system
+     @param lfoBuffer The LFO samples for this block, only read if the LFO modulates the pitch
+     @param modBuffer The modulating oscillator's output for this block
+     @param depth How much of the output is ring modulated, from 0 (none) to 1 (all of it)
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderRing (float* output, int numSamples, float sampleRate, const float* lfoBuffer, const float* modBuffer, float depth)
+    {
+        renderModulator<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer);
+
+        float dry = (1.0f - depth) * *oscGain;
+        float wet = depth * *oscGain;
+
+        for (int i = 0; i < numSamples; i++)
+            output[i] *= dry + (wet * modBuffer[i]);
+    }
+
+    /**
+     Renders a block of this oscillator frequency or phase modulated by another oscillator's output.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     @param sampleRate The sample rate of the system
+     @param lfoBuffer The LFO samples for this block, only read if the LFO modulates the pitch
+     @param modBuffer The modulating oscillator's output for this block
+     @param depth How strong the modulation is, from 0 to 1
+     */
+    template <CrossMod mode, bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderModulated (float* output, int numSamples, float sampleRate, const float* lfoBuffer, const float* modBuffer, float depth)
+    {
+        static_assert (mode == CrossMod::frequency || mode == CrossMod::phase, "Only FM and PM are modulated by the output");
+
+        // FM sweeps the frequency by up to 4 times either way, PM moves the phase by up to a full cycle either way.
+        float index = mode == CrossMod::frequency ? depth * 4.0f : depth;
+
         switch (int (*oscType))
         {
-            case 0:
-                sample = getNextSampleSine();
-                break;
-            case 1:
-                sample = getNextSampleTriangle();
-                break;
-            case 2:
-                sample = getNextSampleSquare();
-                break;
-            case 3:
-                sample = getNextSampleSaw();
-                break;
+            case 0: renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [] (float p, float) { return getFastSineSample (p); }); break;
+            case 1: renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [] (float p, float) { return getTriangleSample (p); }); break;
+            case 2: renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [] (float p, float) { return getSquareSample (p); }); break;
+            case 3: renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [] (float p, float) { return getSawSample (p); }); break;
             case 4:
-                sample = getNextSamplePushSquare();
+            {
+                float push = *oscPush;
+                renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [push] (float p, float) { return std::tanh (push * getFastSineSample (p)); });
                 break;
-            case 5:
-                sample = getNextSampleBetterSaw();
+            }
+            case 5: renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [] (float p, float d) { return getBetterSawSample (p, d); }); break;
+            case sampleType: renderSample<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer); break;
+            default: renderModulatedShape<mode, lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, modBuffer, index, [] (float p, float) { return getTriangleSample (p); });
+        }
+
+        juce::FloatVectorOperations::multiply (output, *oscGain, numSamples);
+    }
+
+    /**
+     Renders a block of this oscillator hard synced to a master oscillator.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     @param sampleRate The sample rate of the system
+     @param lfoBuffer The LFO samples for this block, only read if the LFO modulates the pitch
+     @param syncPositions The master's sync positions for this block, from renderSyncPositions
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderSynced (float* output, int numSamples, float sampleRate, const float* lfoBuffer, const float* syncPositions)
+    {
+        switch (int (*oscType))
+        {
+            case 0: renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [] (float p, float) { return getSineSample (p); }); break;
+            case 1: renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [] (float p, float) { return getTriangleSample (p); }); break;
+            case 2: renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [] (float p, float) { return getSquareSample (p); }); break;
+            case 3: renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [] (float p, float) { return getSawSample (p); }); break;
+            case 4:
+            {
+                float push = *oscPush;
+                renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [push] (float p, float) { return getPushSquareSample (p, push); });
                 break;
-            default:
-                sample = getNextSampleTriangle();
+            }
+            case 5: renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [] (float p, float d) { return getBetterSawSample (p, d); }); break;
+            case sampleType: renderSample<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer); break;
+            default: renderSyncedShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, syncPositions, [] (float p, float) { return getTriangleSample (p); });
+        }
+
+        juce::FloatVectorOperations::multiply (output, *oscGain, numSamples);
+    }
+
+    /**
+     Steps this oscillator as a sync master. For every sample this writes how far through the sample, as a fraction of
+     the sample after the wrap, the phase wrapped, or -1 if it did not wrap.
+
+     @param syncPositions Where to write the positions
+     @param numSamples The number of samples to step
+     @param sampleRate The sample rate of the system
+     @param lfoBuffer The LFO samples for this block, only read if the LFO modulates the pitch
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderSyncPositions (float* syncPositions, int numSamples, float sampleRate, const float* lfoBuffer)
+    {
+        if constexpr (! (lfoAppliesToFrequency || lfoAppliesToCents))
+            updateParams (sampleRate, false, false, 0.0f);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
+                updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, lfoBuffer[i]);
+
+            phase += phaseDelta;
+            bool wrapped = phase >= 1.0f;
+            phase -= wrapped ? 1.0f : 0.0f;
+            syncPositions[i] = wrapped ? phase / phaseDelta : -1.0f;
         }
+    }
 
-        return *oscGain * sample;
+    /**
+     The Push Square shape. Public so that it can also be baked into wavetables.
+     */
+    static float getPushSquareSample (float phase, float push)
+    {
+        return tanh (push * getSineSample (phase));
     }
 
 private:
@@ -150,50 +406,696 @@ private:
     std::atomic<float>* oscOctave;
     std::atomic<float>* oscCents;
     std::atomic<float>* oscPush;
+    std::atomic<float>* oscUnison;
+    std::atomic<float>* oscDetune;
+    std::atomic<float>* aliasThreshold;
+    const MyQuality* quality;
 
     float noteFrequency;
 
     float phaseDelta;
     float phase = 0;
 
-    float pi2 = 2 * M_PI;
+    MyBakedShape* pushSquareShape = nullptr;
+    const MyWavetable* bakedTable = nullptr;
+    juce::uint32 bakedVersion = 0;
+    const MyWavetable* fadeFromTable = nullptr;
+    int fadePosition = 0;
 
-    float getNextSampleSine()
+    enum class Quality
     {
-        return sin (pi2 * getNextPhase());
+        naive,
+        polyBlep,
+        oversampled
+    };
+
+    Quality chosenQuality = Quality::naive;
+    float qualityDelta = 0.0f;
+    float qualityThreshold = 0.0f;
+    bool qualityOversampling = true;
+    int qualityType = -1;
+
+    // The crossfade from the last choice when the choice changes during a note
+    static constexpr float qualityFadeTime = 0.003f;
+    Quality fadeFromQuality = Quality::naive;
+    int qualityFadePosition = 0;
+    int qualityFadeLength = 0;
+
+    // The 2x oversampling decimator, a 15 tap half band filter. Only the centre and odd taps are non-zero.
+    static constexpr int decimatorTaps = 15;
+    static constexpr float decimatorCentre = 0.49983648f;
+    static constexpr float decimatorCoefficients[4] = { 0.29863877f, -0.05884401f, 0.01095199f, -0.00066499f };
+    float decimatorHistory[decimatorTaps - 1] = {};
+
+    static constexpr int sampleType = 6;
+    MySampleStream* sampleStream = nullptr;
+
+    // The sample held back by hard sync so the PolyBLEP correction can reach back to it.
+    float syncDelayedSample = 0.0f;
+
+    static constexpr float pi2 = 2 * M_PI;
+
+    // Unison lanes are processed in groups of this many so that the compiler can keep each group in one SIMD register.
+    static constexpr int laneGroupSize = 4;
+    static constexpr int maxLanes = 16;
+
+    alignas (16) float lanePhases[maxLanes];
+    alignas (16) float laneRatios[maxLanes];
+    alignas (16) float laneGains[maxLanes];
+    int numLanes = 1;
+    float lastDetune = -1.0f;
+
+    // Cleared while rendering as a modulator
+    bool unisonAllowed = true;
+
+    /**
+     Renders a block of whichever type is chosen, without the gain.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderType (float* output, int numSamples, float sampleRate, const float* lfoBuffer)
+    {
+        switch (int (*oscType))
+        {
+            case 0: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, [] (float p, float) { return getSineSample (p); }); break;
+            case 1:
+            {
+                auto triangle = [] (float p, float) { return getTriangleSample (p); };
+
+                chooseQuality<lfoAppliesToFrequency, lfoAppliesToCents> (sampleRate, lfoBuffer, 1, 2, false);
+                renderQuality (output, numSamples, lfoBuffer, [&] (Quality tier, float* tierOutput, int tierSamples, const float* tierLfo)
+                {
+                    if (tier == Quality::oversampled)
+                        renderOversampled<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, triangle);
+                    else
+                        renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, triangle);
+                });
+                break;
+            }
+            case 2:
+            {
+                // The oversampled square is the PolyBLEP one too, given the phase delta at twice the rate
+                auto betterSquare = [] (float p, float d) { return getBetterSquareSample (p, d); };
+
+                chooseQuality<lfoAppliesToFrequency, lfoAppliesToCents> (sampleRate, lfoBuffer, 2, 1, true);
+                renderQuality (output, numSamples, lfoBuffer, [&] (Quality tier, float* tierOutput, int tierSamples, const float* tierLfo)
+                {
+                    switch (tier)
+                    {
+                        case Quality::polyBlep: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, betterSquare); break;
+                        case Quality::oversampled: renderOversampled<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, betterSquare); break;
+                        default: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, [] (float p, float) { return getSquareSample (p); });
+                    }
+                });
+                break;
+            }
+            case 3:
+            {
+                auto betterSaw = [] (float p, float d) { return getBetterSawSample (p, d); };
+
+                chooseQuality<lfoAppliesToFrequency, lfoAppliesToCents> (sampleRate, lfoBuffer, 3, 1, true);
+                renderQuality (output, numSamples, lfoBuffer, [&] (Quality tier, float* tierOutput, int tierSamples, const float* tierLfo)
+                {
+                    switch (tier)
+                    {
+                        case Quality::polyBlep: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, betterSaw); break;
+                        case Quality::oversampled: renderOversampled<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, betterSaw); break;
+                        default: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (tierOutput, tierSamples, sampleRate, tierLfo, [] (float p, float) { return getSawSample (p); });
+                    }
+                });
+                break;
+            }
+            case 4:
+            {
+                if (updateBakedTable())
+                {
+                    renderBaked<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer);
+                    break;
+                }
+
+                float push = *oscPush;
+                renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, [push] (float p, float) { return getPushSquareSample (p, push); });
+                break;
+            }
+            case 5: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, [] (float p, float d) { return getBetterSawSample (p, d); }); break;
+            case sampleType: renderSample<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer); break;
+            default: renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, [] (float p, float) { return getTriangleSample (p); });
+        }
     }
 
-    float getNextSampleTriangle()
+    /**
+     Renders with the given shape, using the unison lanes if there is more than one voice.
+
+     Each shape is a function of the phase and the phase delta (for the band limited shapes) so the same shape can be
+     used for the single oscillator and for every unison lane.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents, typename ShapeFunction>
+    void renderShape (float* output, int numSamples, float sampleRate, const float* lfoBuffer, ShapeFunction shape)
     {
-        return (fabs (getNextPhase() - 0.5) * 4) - 1;
+        updateLanes();
+
+        if (numLanes == 1 || ! unisonAllowed)
+            renderSingle<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, shape);
+        else
+            renderUnison<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, shape);
     }
 
-    float getNextSampleSquare()
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents, typename ShapeFunction>
+    void renderSingle (float* output, int numSamples, float sampleRate, const float* lfoBuffer, ShapeFunction shape)
     {
-        if (getNextPhase() < 0.5)
+        if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
         {
-            return -1;
+            for (int i = 0; i < numSamples; i++)
+            {
+                updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, lfoBuffer[i]);
+                output[i] = shape (getNextPhase(), phaseDelta);
+            }
         }
         else
         {
-            return 1;
+            updateParams (sampleRate, false, false, 0.0f);
+
+            for (int i = 0; i < numSamples; i++)
+                output[i] = shape (getNextPhase(), phaseDelta);
         }
     }
 
-    float getNextSampleSaw()
+    /**
+     Renders all of the unison lanes, summed. The lanes are processed a group at a time with the same operations
+     applied to every lane in the group, so each group is effectively one SIMD oscillator.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents, typename ShapeFunction>
+    void renderUnison (float* output, int numSamples, float sampleRate, const float* lfoBuffer, ShapeFunction shape)
     {
-        return (getNextPhase() * 2) - 1;
+        if constexpr (! (lfoAppliesToFrequency || lfoAppliesToCents))
+            updateParams (sampleRate, false, false, 0.0f);
+
+        int numGroups = (numLanes + laneGroupSize - 1) / laneGroupSize;
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
+                updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, lfoBuffer[i]);
+
+            float sums[laneGroupSize] = {};
+
+            for (int group = 0; group < numGroups; group++)
+            {
+                float* groupPhases = lanePhases + (group * laneGroupSize);
+                const float* groupRatios = laneRatios + (group * laneGroupSize);
+                const float* groupGains = laneGains + (group * laneGroupSize);
+
+                for (int lane = 0; lane < laneGroupSize; lane++)
+                {
+                    float delta = phaseDelta * groupRatios[lane];
+                    float lanePhase = groupPhases[lane] + delta;
+                    lanePhase -= (lanePhase > 1.0f) ? 1.0f : 0.0f;
+                    groupPhases[lane] = lanePhase;
+
+                    sums[lane] += groupGains[lane] * shape (lanePhase, delta);
+                }
+            }
+
+            output[i] = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        }
     }
 
-    float getNextSamplePushSquare()
+    /**
+     Recalculates the lane tuning if the unison count or detune have changed.
+
+            The lanes are spread evenly across the detune range, in cents either side of the note, and their gains are
+            scaled so that adding more lanes keeps roughly the same loudness. Lanes past the unison count are left in place
+            with a gain of zero to fill up the last group.
+     */
+    void updateLanes()
     {
-        return tanh (*oscPush * getNextSampleSine());
+        int unison = juce::jlimit (1, std::min (maxLanes, quality->getSettings().maxUnison), int (*oscUnison));
+        float detune = *oscDetune;
+
+        if (unison == numLanes && detune == lastDetune)
+            return;
+
+        numLanes = unison;
+        lastDetune = detune;
+
+        float laneGain = 1.0f / std::sqrt (float (numLanes));
+
+        for (int lane = 0; lane < maxLanes; lane++)
+        {
+            bool used = lane < numLanes;
+            float position = numLanes > 1 ? ((2.0f * lane) / (numLanes - 1)) - 1.0f : 0.0f;
+
+            laneRatios[lane] = used ? std::pow (2.0f, (position * detune) / 1200.0f) : 1.0f;
+            laneGains[lane] = used ? laneGain : 0.0f;
+        }
     }
 
-    float getNextSampleBetterSaw()
+    /**
+     Chooses the cheapest algorithm that keeps the aliasing below the threshold at the current pitch. If none of them
+     do, the one with the least aliasing is used.
+
+            The aliasing is estimated by getAliasing. Shapes with jumps roll off at 6dB per octave (rolloff 1) and
+            shapes with corners at 12dB per octave (rolloff 2). PolyBLEP smooths the jumps, adding one to the rolloff.
+            Oversampling renders the PolyBLEP shape (where there is one) at twice the rate.
+
+     @param type The oscillator type being rendered, so a change of type is always rechecked
+     @param rolloff How fast the naive shape's harmonics fall away
+     @param hasPolyBlep True if the shape has a PolyBLEP version
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    Quality chooseQuality (float sampleRate, const float* lfoBuffer, int type, int rolloff, bool hasPolyBlep)
     {
-        // TODO: Actually do it!
-        return getNextSampleSaw();
+        updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, (lfoAppliesToFrequency || lfoAppliesToCents) ? lfoBuffer[0] : 0.0f);
+
+        const MyQuality::Settings& settings = quality->getSettings();
+        float threshold = *aliasThreshold + settings.aliasThresholdOffset;
+        float movement = phaseDelta / qualityDelta;
+
+        if (type == qualityType && threshold == qualityThreshold && settings.allowOversampling == qualityOversampling
+            && movement < semitoneRatio && movement > 1.0f / semitoneRatio)
+            return chosenQuality;
+
+        Quality previousQuality = chosenQuality;
+        bool choosingDuringNote = type == qualityType && qualityDelta > 0.0f;
+
+        qualityType = type;
+        qualityThreshold = threshold;
+        qualityOversampling = settings.allowOversampling;
+        qualityDelta = phaseDelta;
+
+        int bestRolloff = hasPolyBlep ? rolloff + 1 : rolloff;
+        float polyBlepAliasing = getAliasing (bestRolloff, false);
+        float oversampledAliasing = getAliasing (bestRolloff, true);
+
+        if (getAliasing (rolloff, false) <= threshold)
+            chosenQuality = Quality::naive;
+        else if (hasPolyBlep && (polyBlepAliasing <= threshold || ! settings.allowOversampling || oversampledAliasing >= polyBlepAliasing))
+            chosenQuality = Quality::polyBlep;
+        else if (settings.allowOversampling && oversampledAliasing < polyBlepAliasing)
+            chosenQuality = Quality::oversampled;
+        else
+            chosenQuality = Quality::naive;
+
+        if (chosenQuality != previousQuality)
+        {
+            // The decimator starts from silence rather than from wherever it was last used, while it is faded in
+            if (chosenQuality == Quality::oversampled)
+                std::fill (decimatorHistory, decimatorHistory + decimatorTaps - 1, 0.0f);
+
+            fadeFromQuality = previousQuality;
+            qualityFadePosition = 0;
+            qualityFadeLength = std::max (1, int (qualityFadeTime * sampleRate));
+        }
+
+        // A new note or type has nothing to fade from
+        if (! choosingDuringNote)
+            qualityFadeLength = 0;
+
+        return chosenQuality;
+    }
+
+    /**
+     Renders with the chosen quality, crossfading from the last choice if it has only just changed. While fading, the
+     old choice is rendered first from the same starting phases, which are then put back so that the new choice is
+     rendered over exactly the same cycle.
+
+     @param renderTier Called with a quality, the output, the number of samples and the LFO to render them with
+     */
+    template <typename TierFunction>
+    void renderQuality (float* output, int numSamples, const float* lfoBuffer, TierFunction renderTier)
+    {
+        constexpr int maxFadeBlock = 64;
+        float oldOutput[maxFadeBlock];
+        float savedLanePhases[maxLanes];
+
+        int start = 0;
+        for (; start < numSamples && qualityFadePosition < qualityFadeLength; start += maxFadeBlock)
+        {
+            int blockSize = std::min (maxFadeBlock, numSamples - start);
+            const float* blockLfo = lfoBuffer != nullptr ? lfoBuffer + start : nullptr;
+
+            float savedPhase = phase;
+            std::copy (lanePhases, lanePhases + maxLanes, savedLanePhases);
+            renderTier (fadeFromQuality, oldOutput, blockSize, blockLfo);
+
+            phase = savedPhase;
+            std::copy (savedLanePhases, savedLanePhases + maxLanes, lanePhases);
+            renderTier (chosenQuality, output + start, blockSize, blockLfo);
+
+            for (int i = 0; i < blockSize; i++)
+            {
+                float newAmount = std::min (1.0f, float (qualityFadePosition + i) / float (qualityFadeLength));
+                output[start + i] = oldOutput[i] + (newAmount * (output[start + i] - oldOutput[i]));
+            }
+
+            qualityFadePosition += blockSize;
+        }
+
+        if (start < numSamples)
+            renderTier (chosenQuality, output + start, numSamples - start, lfoBuffer != nullptr ? lfoBuffer + start : nullptr);
+    }
+
+    /**
+     Estimates the loudest aliasing at the current pitch, in dB relative to the fundamental.
+
+            Harmonic k is about 1 / k ^ rolloff of the fundamental, and the loudest one to fold back is the first above
+            Nyquist. When oversampling, the harmonics up to the new Nyquist are rendered cleanly but the ones above the
+            old Nyquist still fold back when decimating, less whatever the decimator takes off. This is only about 6dB
+            right at Nyquist, rising to 55dB by 0.8 of it. The first harmonic above the new Nyquist folds back while
+            rendering and is then mostly taken off by the decimator.
+
+     @param rolloff How fast the harmonics of the shape being rendered fall away
+     @param oversampled True if the shape is rendered at twice the rate and decimated
+     */
+    float getAliasing (int rolloff, bool oversampled) const
+    {
+        float delta = std::max (std::fabs (phaseDelta), 1.0e-6f);
+
+        float firstFolded = std::floor (0.5f / delta) + 1.0f;
+        float aliasing = -20.0f * float (rolloff) * std::log10 (firstFolded);
+        if (! oversampled)
+            return aliasing;
+
+        // Frequencies are given to the decimator as a fraction of the doubled rate
+        float firstFoldedWhenRendering = std::floor (1.0f / delta) + 1.0f;
+        float foldedWhenRendering = -20.0f * float (rolloff) * std::log10 (firstFoldedWhenRendering)
+                                    + getDecimatorGain (1.0f - (0.5f * firstFoldedWhenRendering * delta));
+
+        return std::max (aliasing + getDecimatorGain (0.5f * firstFolded * delta), foldedWhenRendering);
+    }
+
+    /**
+     @param frequency A frequency as a fraction of the oversampled rate
+     @return The decimator's gain at that frequency, in dB
+     */
+    static float getDecimatorGain (float frequency)
+    {
+        float response = decimatorCentre;
+        for (int tap = 0; tap < 4; tap++)
+            response += 2.0f * decimatorCoefficients[tap] * std::cos (pi2 * frequency * float ((2 * tap) + 1));
+
+        return 20.0f * std::log10 (std::max (std::fabs (response), 1.0e-6f));
+    }
+
+    static constexpr float semitoneRatio = 1.059463f;
+
+    /**
+     Renders the shape at twice the sample rate and decimates it back down. The LFO is held for both of the
+     oversampled samples it covers.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents, typename ShapeFunction>
+    void renderOversampled (float* output, int numSamples, float sampleRate, const float* lfoBuffer, ShapeFunction shape)
+    {
+        constexpr int maxBlock = 32;
+        constexpr int historySize = decimatorTaps - 1;
+        float oversampled[historySize + (2 * maxBlock)];
+        float oversampledLfo[2 * maxBlock];
+
+        for (int start = 0; start < numSamples; start += maxBlock)
+        {
+            int blockSize = std::min (maxBlock, numSamples - start);
+
+            if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
+            {
+                for (int i = 0; i < blockSize; i++)
+                    oversampledLfo[2 * i] = oversampledLfo[(2 * i) + 1] = lfoBuffer[start + i];
+            }
+
+            std::copy (decimatorHistory, decimatorHistory + historySize, oversampled);
+            renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (oversampled + historySize, 2 * blockSize, sampleRate * 2.0f, oversampledLfo, shape);
+
+            for (int i = 0; i < blockSize; i++)
+            {
+                const float* centre = oversampled + (2 * i) + (historySize / 2);
+                float sum = decimatorCentre * centre[0];
+
+                for (int tap = 0; tap < 4; tap++)
+                {
+                    int offset = (2 * tap) + 1;
+                    sum += decimatorCoefficients[tap] * (centre[-offset] + centre[offset]);
+                }
+
+                output[start + i] = sum;
+            }
+
+            std::copy (oversampled + (2 * blockSize), oversampled + (2 * blockSize) + historySize, decimatorHistory);
+        }
+    }
+
+    /**
+     Picks up a newly baked table, starting a crossfade from the old one if this oscillator was already playing it.
+
+     @return True if there is a baked table to play
+     */
+    bool updateBakedTable()
+    {
+        if (pushSquareShape == nullptr)
+            return false;
+
+        juce::uint32 version = pushSquareShape->getVersion();
+        if (version != bakedVersion)
+        {
+            // Only a fade from the table this oscillator was playing, which is the shape's previous one
+            fadeFromTable = version == bakedVersion + 1 ? pushSquareShape->getFadeFromTable() : nullptr;
+            fadePosition = 0;
+
+            bakedTable = pushSquareShape->getTable();
+            bakedVersion = version;
+        }
+
+        // Once the new table has settled the baker is free to write over the old one, so any fade that has not finished
+        // (because this oscillator was switched to another type part way through) is dropped. This and the old table
+        // come from the same block so the old table is always safe to read.
+        if (pushSquareShape->getFadeFromTable() == nullptr)
+            fadeFromTable = nullptr;
+
+        return bakedTable != nullptr;
+    }
+
+    /**
+     Renders from the baked table. While fading, the old table is rendered first from the same starting phases, which
+     are then put back so that the new table is rendered over exactly the same cycle.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderBaked (float* output, int numSamples, float sampleRate, const float* lfoBuffer)
+    {
+        const MyWavetable* table = bakedTable;
+        auto tableShape = [table] (float p, float d) { return table->getSample (p, d); };
+
+        if (fadeFromTable == nullptr)
+        {
+            renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output, numSamples, sampleRate, lfoBuffer, tableShape);
+            return;
+        }
+
+        const MyWavetable* oldTable = fadeFromTable;
+        auto oldTableShape = [oldTable] (float p, float d) { return oldTable->getSample (p, d); };
+
+        constexpr int maxFadeBlock = 64;
+        float oldOutput[maxFadeBlock];
+        float savedLanePhases[maxLanes];
+
+        for (int start = 0; start < numSamples; start += maxFadeBlock)
+        {
+            int blockSize = std::min (maxFadeBlock, numSamples - start);
+            const float* blockLfo = lfoBuffer != nullptr ? lfoBuffer + start : nullptr;
+
+            float savedPhase = phase;
+            std::copy (lanePhases, lanePhases + maxLanes, savedLanePhases);
+            renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (oldOutput, blockSize, sampleRate, blockLfo, oldTableShape);
+
+            phase = savedPhase;
+            std::copy (savedLanePhases, savedLanePhases + maxLanes, lanePhases);
+            renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output + start, blockSize, sampleRate, blockLfo, tableShape);
+
+            for (int i = 0; i < blockSize; i++)
+            {
+                float newAmount = std::min (1.0f, float (fadePosition + i) / float (MyBakedShape::fadeLength));
+                output[start + i] = oldOutput[i] + (newAmount * (output[start + i] - oldOutput[i]));
+            }
+
+            fadePosition += blockSize;
+            if (fadePosition >= MyBakedShape::fadeLength)
+            {
+                fadeFromTable = nullptr;
+                if (start + blockSize < numSamples)
+                    renderShape<lfoAppliesToFrequency, lfoAppliesToCents> (output + start + blockSize, numSamples - start - blockSize, sampleRate, blockLfo != nullptr ? blockLfo + blockSize : nullptr, tableShape);
+                return;
+            }
+        }
+    }
+
+    /**
+     Renders the Sample type. The phase delta is the number of cycles per sample at the oscillator's pitch, so scaling it
+     by the sample's rate over the root note's frequency gives the number of sample frames to move on by.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents>
+    void renderSample (float* output, int numSamples, float sampleRate, const float* lfoBuffer)
+    {
+        const MySample* sample = sampleStream != nullptr ? sampleStream->getSample() : nullptr;
+        if (sample == nullptr)
+        {
+            juce::FloatVectorOperations::clear (output, numSamples);
+            return;
+        }
+
+        float rateScale = float (sample->getSampleRate() / juce::MidiMessage::getMidiNoteInHertz (MySample::rootNote));
+
+        if constexpr (! (lfoAppliesToFrequency || lfoAppliesToCents))
+            updateParams (sampleRate, false, false, 0.0f);
+
+        sampleStream->render (output, numSamples, [&] (int i) {
+            if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
+                updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, lfoBuffer[i]);
+            else
+                juce::ignoreUnused (i);
+
+            return phaseDelta * rateScale;
+        });
+    }
+
+    template <CrossMod mode, bool lfoAppliesToFrequency, bool lfoAppliesToCents, typename ShapeFunction>
+    void renderModulatedShape (float* output, int numSamples, float sampleRate, const float* lfoBuffer, const float* modBuffer, float index, ShapeFunction shape)
+    {
+        if constexpr (! (lfoAppliesToFrequency || lfoAppliesToCents))
+            updateParams (sampleRate, false, false, 0.0f);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
+                updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, lfoBuffer[i]);
+
+            if constexpr (mode == CrossMod::frequency)
+            {
+                // The increment can go negative so the phase is wrapped both ways.
+                float delta = phaseDelta * (1.0f + (index * modBuffer[i]));
+                phase += delta;
+                phase -= std::floor (phase);
+                output[i] = shape (phase, std::fabs (delta));
+            }
+            else
+            {
+                float modulatedPhase = getNextPhase() + (index * modBuffer[i]);
+                modulatedPhase -= std::floor (modulatedPhase);
+                output[i] = shape (modulatedPhase, phaseDelta);
+            }
+        }
+    }
+
+    /**
+     The hard sync loop. When the master wraps part way through a sample, this oscillator's phase is reset at the same
+     point. The size of the jump is found from the naive shape (a phase delta of 0 turns off any PolyBLEP in the shape)
+     and the PolyBLEP residual is added to the samples either side of it. The output is one sample behind so that the
+     sample before the jump can still be corrected.
+     */
+    template <bool lfoAppliesToFrequency, bool lfoAppliesToCents, typename ShapeFunction>
+    void renderSyncedShape (float* output, int numSamples, float sampleRate, const float* lfoBuffer, const float* syncPositions, ShapeFunction shape)
+    {
+        if constexpr (! (lfoAppliesToFrequency || lfoAppliesToCents))
+            updateParams (sampleRate, false, false, 0.0f);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            if constexpr (lfoAppliesToFrequency || lfoAppliesToCents)
+                updateParams (sampleRate, lfoAppliesToFrequency, lfoAppliesToCents, lfoBuffer[i]);
+
+            float sample;
+            float sincePosition = syncPositions[i];
+
+            if (sincePosition >= 0.0f)
+            {
+                float phaseAtReset = phase + ((1.0f - sincePosition) * phaseDelta);
+                phaseAtReset -= std::floor (phaseAtReset);
+                float jump = shape (0.0f, 0.0f) - shape (phaseAtReset, 0.0f);
+
+                phase = sincePosition * phaseDelta;
+                sample = shape (phase, phaseDelta);
+
+                float before = sincePosition;
+                float after = 1.0f - sincePosition;
+                syncDelayedSample += jump * (before * before * 0.5f);
+                sample -= jump * (after * after * 0.5f);
+            }
+            else
+            {
+                sample = shape (getNextPhase(), phaseDelta);
+            }
+
+            output[i] = syncDelayedSample;
+            syncDelayedSample = sample;
+        }
+    }
+
+    /**
+     A polynomial approximation of sin (2 pi phase), accurate to about 0.001. It has no branches so it vectorises well.
+     */
+    static float getFastSineSample (float phase)
+    {
+        // sin (2 pi phase) = -sin (pi u) with u from -1 to 1
+        float u = (2.0f * phase) - 1.0f;
+        float y = 4.0f * u * (1.0f - std::fabs (u));
+        y = (0.225f * ((y * std::fabs (y)) - y)) + y;
+        return -y;
+    }
+
+    static float getSineSample (float phase)
+    {
+        return sin (pi2 * phase);
+    }
+
+    static float getTriangleSample (float phase)
+    {
+        return (fabs (phase - 0.5) * 4) - 1;
+    }
+
+    static float getSquareSample (float phase)
+    {
+        return phase < 0.5f ? -1.0f : 1.0f;
+    }
+
+    static float getSawSample (float phase)
+    {
+        return (phase * 2) - 1;
+    }
+
+    /**
+     Sawtooth with PolyBLEP anti-aliasing. The jump in the naive sawtooth is smoothed out with a polynomial over the
+     samples either side of it, which removes most of the aliasing for very little cost.
+     */
+    static float getBetterSawSample (float phase, float phaseDelta)
+    {
+        return getSawSample (phase) - getPolyBlep (phase, phaseDelta);
+    }
+
+    /**
+     Square with PolyBLEP anti-aliasing, correcting the jump down at phase 0 and the jump up half way through.
+     */
+    static float getBetterSquareSample (float phase, float phaseDelta)
+    {
+        float halfPhase = phase + 0.5f;
+        halfPhase -= halfPhase >= 1.0f ? 1.0f : 0.0f;
+        return getSquareSample (phase) - getPolyBlep (phase, phaseDelta) + getPolyBlep (halfPhase, phaseDelta);
+    }
+
+    /**
+     The polynomial band limited step correction for a discontinuity of height 2 at phase 0.
+
+     @param phase The current phase, between 0 and 1
+     @param phaseDelta The phase increment per sample
+     */
+    static float getPolyBlep (float phase, float phaseDelta)
+    {
+        if (phase < phaseDelta)
+        {
+            float t = phase / phaseDelta;
+            return t + t - t * t - 1.0f;
+        }
+        else if (phase > 1.0f - phaseDelta)
+        {
+            float t = (phase - 1.0f) / phaseDelta;
+            return t * t + t + t + 1.0f;
+        }
+
+        return 0.0f;
     }
 
     float getNextPhase()
@@ -15,20 +15,38 @@
     There are also some helper classes provided that make the main code a bit
     cleaner.
 
+    The quality settings in use are also kept here since every module already
+    has a pointer to this class. They are worked out from the quality
+    parameters by the processor at the start of every block.
+
+    Every parameter that something depends on gets a version counter which is
+    bumped by a parameter listener whenever the value changes. MyParameterWatcher
+    wraps a set of these counters so that a module can cheaply check whether any
+    of its inputs have changed since it last recalculated its coefficients,
+    envelope rates and so on, and skip the work entirely when they have not.
+
   ==============================================================================
 */
 
 #pragma once
 
+#include "MyQuality.h"
 #include <JuceHeader.h>
+#include <map>
 
 // Specifying the std namepsace to help reduce the length of some longer lines.
 using namespace std;
 
-class MyParameters
+class MyParameters : private juce::AudioProcessorValueTreeState::Listener
 {
 public:
     
+    /// The most taps the multi tap delay can have
+    static constexpr int maxDelayTaps = 16;
+
+    /// The longest delay_delay_time, beyond which the longer max delay times use delay_long_time instead
+    static constexpr float maxShortDelayTime = 2.0f;
+
     /**
      Simple helper for making a float parameter.
      
@@ -85,6 +103,27 @@ public:
         return make_unique<juce::AudioParameterBool> (paramId, paramName, defaultVal);
     }
 
+    /**
+     Adds the time, gain and pan parameters for each tap of the multi tap delay, which are too many to list by hand.
+
+     @param layout The layout with every other parameter in it
+     */
+    static juce::AudioProcessorValueTreeState::ParameterLayout addDelayTapParameters (juce::AudioProcessorValueTreeState::ParameterLayout layout)
+    {
+        for (int tap = 0; tap < maxDelayTaps; tap++)
+        {
+            string id = "delay_tap_" + to_string (tap + 1);
+            string name = "Delay: Tap " + to_string (tap + 1);
+
+            // Eighth notes at 120bpm, each quieter than the last and alternating left and right
+            layout.add (makeSkewedFloat (id + "_time", name + " Time (s)", 0.001f, 32.0f, 0.3f, 0.25f * float (tap + 1)),
+                        makeFloat (id + "_gain", name + " Gain", 0.0f, 1.0f, 1.0f / (1.0f + (0.5f * float (tap)))),
+                        makeFloat (id + "_pan", name + " Pan", -1.0f, 1.0f, tap % 2 == 0 ? -0.5f : 0.5f));
+        }
+
+        return layout;
+    }
+
     /**
      Simple helper for making a parameter with a list of specific choices.
      
@@ -107,6 +146,8 @@ public:
     atomic<float>* osc1Octave;
     atomic<float>* osc1Cents;
     atomic<float>* osc1Push;
+    atomic<float>* osc1Unison;
+    atomic<float>* osc1Detune;
 
     // Oscillator 2 Parameters
     juce::AudioParameterChoice* osc2Type;
@@ -114,10 +155,20 @@ public:
     atomic<float>* osc2Octave;
     atomic<float>* osc2Cents;
     atomic<float>* osc2Push;
+    atomic<float>* osc2Unison;
+    atomic<float>* osc2Detune;
+
+    // Cross Modulation Parameters
+    juce::AudioParameterChoice* oscModMode;
+    atomic<float>* oscModDepth;
+
+    // Oscillator Quality Parameters
+    atomic<float>* oscAliasThreshold;
 
     // Noise Generator Parameters
     juce::AudioParameterBool* noiseOn;
     atomic<float>* noiseGain;
+    juce::AudioParameterChoice* noiseColour;
     atomic<float>* noiseFilter;
     atomic<float>* noiseDuration;
 
@@ -138,16 +189,22 @@ public:
     atomic<float>* filterDecay;
     atomic<float>* filterSustain;
     atomic<float>* filterRelease;
+    juce::AudioParameterChoice* filterCurve;
 
     // Amplitude Envelope and Distortion Parameters
     atomic<float>* ampEnvAttack;
     atomic<float>* ampEnvDecay;
     atomic<float>* ampEnvSustain;
     atomic<float>* ampEnvRelease;
+    juce::AudioParameterChoice* ampEnvCurve;
     juce::AudioParameterBool* ampDistOn;
     atomic<float>* ampDistGain;
     atomic<float>* ampVolume;
 
+    // Voice Stereo Parameters
+    juce::AudioParameterChoice* voicePanMode;
+    atomic<float>* voicePanSpread;
+
     // Delay Parameters
     juce::AudioParameterBool* delayOn;
     juce::AudioParameterChoice* delayType;
@@ -156,6 +213,19 @@ public:
     atomic<float>* delayDryLevel;
     atomic<float>* delayFeedback;
     atomic<float>* delayDepth;
+    /// Sizes the delay lines for 2, 8 or 32 seconds. Their memory grows with the time, so 32 seconds at 96kHz is 49MB
+    /// of floats, or 25MB with delayCompact (MyDelay.h)
+    juce::AudioParameterChoice* delayMaxTime;
+    /// Used in place of delayTime when delayMaxTime is longer than maxShortDelayTime, see getDelayTime
+    atomic<float>* delayLongTime;
+    atomic<float>* delayTaps;
+    atomic<float>* delayTapTimes[maxDelayTaps];
+    atomic<float>* delayTapGains[maxDelayTaps];
+    atomic<float>* delayTapPans[maxDelayTaps];
+    /// Stores the delay lines as bfloat16, halving their memory at the cost of rounding noise about 48dB below the
+    /// signal on every pass round the feedback loop (MyDelay.h)
+    juce::AudioParameterBool* delayCompact;
+    juce::AudioParameterBool* delayTails;
 
     // Reverb Parameters
     juce::AudioParameterBool* reverbOn;
@@ -164,29 +234,58 @@ public:
     atomic<float>* reverbWetLevel;
     atomic<float>* reverbDryLevel;
     atomic<float>* reverbWidth;
+    juce::AudioParameterBool* reverbTails;
+
+    // Quality Parameters
+    juce::AudioParameterChoice* qualityMode;
+    juce::AudioParameterBool* qualityRenderOffline;
+    juce::AudioParameterBool* qualityGovernor;
+    juce::AudioParameterChoice* qualityEngineRate;
+    juce::AudioParameterChoice* qualityBlockSize;
+    juce::AudioParameterBool* qualityBlockZeroLatency;
+    juce::AudioParameterBool* qualityPipeline;
+    /// Locks the arena's buffers in RAM (MyArena.h). The juce::Reverb tanks, the engine rate, block adapter and
+    /// pipeline buffers and the sample streams' rings are not in the arena, so they are not locked.
+    juce::AudioParameterBool* qualityLockMemory;
+    juce::AudioParameterChoice* qualityEcoReverbRate;
+
+    /// The quality settings for the current block, see MyQuality.h
+    MyQuality quality;
 
     MyParameters (juce::AudioProcessor& audioProcessor)
         : apvts (audioProcessor,
                  nullptr,
                  "MyParameters",
-                 {
+                 addDelayTapParameters ({
                      // Oscillator 1 Parameters
-                     makeChoice ("osc1_type", "Osc 1: Type", { "Sine", "Triangle", "Square", "Sawtooth", "Push Square", "Better Sawtooth" }, 0),
+                     makeChoice ("osc1_type", "Osc 1: Type", { "Sine", "Triangle", "Square", "Sawtooth", "Push Square", "Better Sawtooth", "Sample" }, 0),
                      makeFloat ("osc1_gain", "Osc 1: Gain", 0.0f, 1.0f, 0.5f),
                      makeInt ("osc1_octave", "Osc 1: Octave", -2, 2, 0),
                      makeInt ("osc1_cents", "Osc 1: Cents", -100, 100, 0),
                      makeSkewedFloat ("osc1_push", "Osc 1: Push", 1.0f, 100.0f, 0.33f, 1.0f),
+                     makeInt ("osc1_unison", "Osc 1: Unison", 1, 16, 1),
+                     makeFloat ("osc1_detune", "Osc 1: Unison Detune", 0.0f, 100.0f, 20.0f),
 
                      // Oscillator 2 Parameters
-                     makeChoice ("osc2_type", "Osc 2: Type", { "Sine", "Triangle", "Square", "Sawtooth", "Push Square", "Better Sawtooth" }, 0),
+                     makeChoice ("osc2_type", "Osc 2: Type", { "Sine", "Triangle", "Square", "Sawtooth", "Push Square", "Better Sawtooth", "Sample" }, 0),
                      makeFloat ("osc2_gain", "Osc 2: Gain", 0.0f, 1.0f, 0.5f),
                      makeInt ("osc2_octave", "Osc 2: Octave", -2, 2, 0),
                      makeInt ("osc2_cents", "Osc 2: Cents", -100, 100, 0),
                      makeSkewedFloat ("osc2_push", "Osc 2: Push", 1.0f, 100.0f, 0.33f, 1.0f),
+                     makeInt ("osc2_unison", "Osc 2: Unison", 1, 16, 1),
+                     makeFloat ("osc2_detune", "Osc 2: Unison Detune", 0.0f, 100.0f, 20.0f),
+
+                     // Cross Modulation Parameters
+                     makeChoice ("osc_mod_mode", "Osc: Cross Modulation", { "Off", "FM", "Phase Mod", "Ring Mod", "Hard Sync" }, 0),
+                     makeFloat ("osc_mod_depth", "Osc: Cross Modulation Depth", 0.0f, 1.0f, 0.5f),
+
+                     // Oscillator Quality Parameters
+                     makeFloat ("osc_alias_threshold", "Osc: Alias Threshold (dB)", -120.0f, 0.0f, -60.0f),
 
                      // Noise Generator Parameters
                      makeBool ("noise_on", "Noise: On", false),
                      makeFloat ("noise_gain", "Noise: Gain", 0.0f, 1.0f, 0.0f),
+                     makeChoice ("noise_colour", "Noise: Colour", { "White", "Pink", "Brown" }, 0),
                      makeFloat ("noise_filter", "Noise: Filter", 0.0f, 1.0f, 1.0f),
                      makeSkewedFloat ("noise_duration", "Noise: Duration", 0.0f, 100.0f, 0.25f, 1.0f),
 
@@ -207,24 +306,35 @@ public:
                      makeFloat ("filter_decay", "Filter: Decay", 0.0f, 1.0f, 0.33f),
                      makeFloat ("filter_sustain", "Filter: Sustain", 0.0f, 1.0f, 0.5f),
                      makeFloat ("filter_release", "Filter: Release", 0.0f, 1.0f, 0.1f),
+                     makeChoice ("filter_curve", "Filter: Envelope Curve", { "Linear", "Exponential" }, 0),
 
                      // Amp Envelope and Distortion Parameters
                      makeFloat ("amp_env_attack", "Amp: Envelope Attack", 0.001f, 1.0f, 0.1f),
                      makeFloat ("amp_env_decay", "Amp: Envelope Decay", 0.0f, 1.0f, 0.33f),
                      makeFloat ("amp_env_sustain", "Amp: Envelope Sustain", 0.0f, 1.0f, 0.5f),
                      makeFloat ("amp_env_release", "Amp: Envelope Release", 0.0f, 1.0f, 0.1f),
+                     makeChoice ("amp_env_curve", "Amp: Envelope Curve", { "Linear", "Exponential" }, 0),
                      makeBool ("amp_dist_on", "Amp: Distortion On", false),
                      makeSkewedFloat ("amp_dist_gain", "Amp: Distortion Gain", 1.0f, 100.0f, 0.4f, 1.0f),
                      makeSkewedFloat ("amp_volume", "Amp: Volume", 0.0f, 1.0f, 0.25f, 0.1f),
 
+                     // Voice Stereo Parameters
+                     makeChoice ("voice_pan_mode", "Voice: Pan Mode", { "Centre", "Per Note", "Alternating", "Random" }, 0),
+                     makeFloat ("voice_pan_spread", "Voice: Pan Spread", 0.0f, 1.0f, 0.5f),
+
                      // Delay Parameters
                      makeBool ("delay_on", "Delay: On", false),
-                     makeChoice ("delay_type", "Delay: Type", { "Normal", "Ping Pong" }, 1),
-                     makeFloat ("delay_delay_time", "Delay: Delay Time (s)", 0.0f, 2.0f, 0.5f),
+                     makeChoice ("delay_type", "Delay: Type", { "Normal", "Ping Pong", "Multi Tap" }, 1),
+                     makeFloat ("delay_delay_time", "Delay: Delay Time (s)", 0.0f, maxShortDelayTime, 0.5f),
                      makeFloat ("delay_wet_level", "Delay: Wet Level", 0.0f, 1.0f, 0.0f),
                      makeFloat ("delay_dry_level", "Delay: Dry Level", 0.0f, 1.0f, 0.4f),
                      makeFloat ("delay_feedback", "Delay: Feedback", 0.0f, 1.0f, 0.0f),
                      makeFloat ("delay_depth", "Delay: Depth", 0.5f, 1.0f, 1.0f),
+                     makeChoice ("delay_max_time", "Delay: Max Time (Uses RAM)", { "2 s", "8 s", "32 s" }, 0),
+                     makeSkewedFloat ("delay_long_time", "Delay: Long Delay Time (s)", 0.0f, 32.0f, 0.3f, 4.0f),
+                     makeInt ("delay_taps", "Delay: Taps", 1, maxDelayTaps, 4),
+                     makeBool ("delay_compact", "Delay: Compact 16-bit Storage", false),
+                     makeBool ("delay_tails", "Delay: Tails On Bypass", false),
 
                      // Reverb Parameters
                      makeBool ("reverb_on", "Reverb: On", false),
@@ -232,7 +342,19 @@ public:
                      makeFloat ("reverb_damping", "Reverb: Damping", 0.0f, 1.0f, 0.5f),
                      makeFloat ("reverb_wet_level", "Reverb: Wet Level", 0.0f, 1.0f, 0.33f),
                      makeFloat ("reverb_dry_level", "Reverb: Dry Level", 0.0f, 1.0f, 0.4f),
-                     makeFloat ("reverb_width", "Reverb: Width", 0.0f, 1.0f, 1.0f) }),
+                     makeFloat ("reverb_width", "Reverb: Width", 0.0f, 1.0f, 1.0f),
+                     makeBool ("reverb_tails", "Reverb: Tails On Bypass", false),
+
+                     // Quality Parameters
+                     makeChoice ("quality_mode", "Quality: Mode", { "Eco", "Live", "Render" }, 1),
+                     makeBool ("quality_render_offline", "Quality: Render When Offline", true),
+                     makeBool ("quality_governor", "Quality: CPU Governor", false),
+                     makeChoice ("quality_engine_rate", "Quality: Engine Rate", { "Host", "44.1/48 kHz" }, 0),
+                     makeChoice ("quality_block_size", "Quality: Block Size", { "Host", "64", "128" }, 0),
+                     makeBool ("quality_block_zero_latency", "Quality: Zero Latency Blocks", false),
+                     makeBool ("quality_pipeline", "Quality: Pipeline Voices And Effects", false),
+                     makeBool ("quality_lock_memory", "Quality: Lock DSP Memory", false),
+                     makeChoice ("quality_eco_reverb_rate", "Quality: Eco Reverb Rate", { "Full", "Half", "Quarter" }, 0) })),
 
           // Oscillator 1 Parameters
           osc1Type (getChoice ("osc1_type")),
@@ -240,6 +362,8 @@ public:
           osc1Octave (getFloat ("osc1_octave")),
           osc1Cents (getFloat ("osc1_cents")),
           osc1Push (getFloat ("osc1_push")),
+          osc1Unison (getFloat ("osc1_unison")),
+          osc1Detune (getFloat ("osc1_detune")),
 
           // Oscillator 2 Parameters
           osc2Type (getChoice ("osc2_type")),
@@ -247,10 +371,20 @@ public:
           osc2Octave (getFloat ("osc2_octave")),
           osc2Cents (getFloat ("osc2_cents")),
           osc2Push (getFloat ("osc2_push")),
+          osc2Unison (getFloat ("osc2_unison")),
+          osc2Detune (getFloat ("osc2_detune")),
+
+          // Cross Modulation Parameters
+          oscModMode (getChoice ("osc_mod_mode")),
+          oscModDepth (getFloat ("osc_mod_depth")),
+
+          // Oscillator Quality Parameters
+          oscAliasThreshold (getFloat ("osc_alias_threshold")),
 
           // Noise Generator Parameters
           noiseOn (getBool ("noise_on")),
           noiseGain (getFloat ("noise_gain")),
+          noiseColour (getChoice ("noise_colour")),
           noiseFilter (getFloat ("noise_filter")),
           noiseDuration (getFloat ("noise_duration")),
 
@@ -271,16 +405,22 @@ public:
           filterDecay (getFloat ("filter_decay")),
           filterSustain (getFloat ("filter_sustain")),
           filterRelease (getFloat ("filter_release")),
+          filterCurve (getChoice ("filter_curve")),
 
           // Amp Envelope and Distortion Parameters
           ampEnvAttack (getFloat ("amp_env_attack")),
           ampEnvDecay (getFloat ("amp_env_decay")),
           ampEnvSustain (getFloat ("amp_env_sustain")),
           ampEnvRelease (getFloat ("amp_env_release")),
+          ampEnvCurve (getChoice ("amp_env_curve")),
           ampDistOn (getBool ("amp_dist_on")),
           ampDistGain (getFloat ("amp_dist_gain")),
           ampVolume (getFloat ("amp_volume")),
 
+          // Voice Stereo Parameters
+          voicePanMode (getChoice ("voice_pan_mode")),
+          voicePanSpread (getFloat ("voice_pan_spread")),
+
           // Delay Parameters
           delayOn (getBool ("delay_on")),
           delayType (getChoice ("delay_type")),
@@ -289,6 +429,11 @@ public:
           delayDryLevel (getFloat ("delay_dry_level")),
           delayFeedback (getFloat ("delay_feedback")),
           delayDepth (getFloat ("delay_depth")),
+          delayMaxTime (getChoice ("delay_max_time")),
+          delayLongTime (getFloat ("delay_long_time")),
+          delayTaps (getFloat ("delay_taps")),
+          delayCompact (getBool ("delay_compact")),
+          delayTails (getBool ("delay_tails")),
 
           // Reverb Parameters
           reverbOn (getBool ("reverb_on")),
@@ -296,12 +441,74 @@ public:
           reverbDamping (getFloat ("reverb_damping")),
           reverbWetLevel (getFloat ("reverb_wet_level")),
           reverbDryLevel (getFloat ("reverb_dry_level")),
-          reverbWidth (getFloat ("reverb_width"))
+          reverbWidth (getFloat ("reverb_width")),
+          reverbTails (getBool ("reverb_tails")),
+
+          // Quality Parameters
+          qualityMode (getChoice ("quality_mode")),
+          qualityRenderOffline (getBool ("quality_render_offline")),
+          qualityGovernor (getBool ("quality_governor")),
+          qualityEngineRate (getChoice ("quality_engine_rate")),
+          qualityBlockSize (getChoice ("quality_block_size")),
+          qualityBlockZeroLatency (getBool ("quality_block_zero_latency")),
+          qualityPipeline (getBool ("quality_pipeline")),
+          qualityLockMemory (getBool ("quality_lock_memory")),
+          qualityEcoReverbRate (getChoice ("quality_eco_reverb_rate"))
+    {
+        for (int tap = 0; tap < maxDelayTaps; tap++)
+        {
+            string id = "delay_tap_" + to_string (tap + 1);
+            delayTapTimes[tap] = getFloat (id + "_time");
+            delayTapGains[tap] = getFloat (id + "_gain");
+            delayTapPans[tap] = getFloat (id + "_pan");
+        }
+    }
+
+    /**
+     Gets the delay time for the Normal and Ping Pong delays. delay_delay_time keeps its original 0 to 2 second range,
+     so the longer max times take their time from delay_long_time instead.
+
+     @param maxDelayTime The longest delay the delay lines were sized for, in seconds
+     @return The delay time in seconds, no longer than maxDelayTime
+     */
+    float getDelayTime (float maxDelayTime) const
+    {
+        float time = maxDelayTime > maxShortDelayTime ? delayLongTime->load() : delayTime->load();
+        return std::min (time, maxDelayTime);
+    }
+
+    /**
+     Gets the version counter for a parameter, creating it and starting to listen to the parameter if needed.
+
+     This allocates so must only be called when setting things up, never from the audio thread.
+
+     @param paramId The ID for the parameter
+     @return A counter that is incremented every time the parameter changes
+     */
+    atomic<uint32_t>* getVersionCounter (const string& paramId)
     {
-        // empty
+        juce::String key (paramId);
+        auto found = versionCounters.find (key);
+        if (found != versionCounters.end())
+            return &found->second;
+
+        auto* counter = &versionCounters[key];
+        apvts.addParameterListener (key, this);
+        return counter;
     }
     
 private:
+    // Node based so the counters never move once handed out. Keyed by juce::String so that parameterChanged, which
+    // can be called on the audio thread during automation, looks the counter up without allocating.
+    map<juce::String, atomic<uint32_t>> versionCounters;
+
+    void parameterChanged (const juce::String& paramId, float) override
+    {
+        auto found = versionCounters.find (paramId);
+        if (found != versionCounters.end())
+            found->second.fetch_add (1, memory_order_release);
+    }
+
     /**
      Helper to get a float parameter back from the Audio Processor Value Tree State.
      
@@ -332,3 +539,53 @@ private:
         return dynamic_cast<juce::AudioParameterBool*> (apvts.getParameter (paramId));
     }
 };
+
+/**
+ Tracks whether any of a set of parameters has changed since it was last checked.
+
+ Each module that derives state from the parameters keeps one of these so it only recalculates when its inputs change.
+ Since the version counters only ever increase, their sum changes whenever any one of them does.
+ */
+class MyParameterWatcher
+{
+public:
+    /**
+     @param params The user editable parameters
+     @param paramIds The IDs of the parameters to watch
+     */
+    MyParameterWatcher (MyParameters* params, initializer_list<string> paramIds)
+    {
+        for (auto& paramId : paramIds)
+            counters.push_back (params->getVersionCounter (paramId));
+    }
+
+    /**
+     @return True if any of the watched parameters changed since the last call, or if this is the first call or forceChanged was called
+     */
+    bool hasChanged()
+    {
+        uint32_t sum = 0;
+        for (auto* counter : counters)
+            sum += counter->load (memory_order_acquire);
+
+        if (sum == lastSeenSum && ! forced)
+            return false;
+
+        lastSeenSum = sum;
+        forced = false;
+        return true;
+    }
+
+    /**
+     Makes the next call to hasChanged return true, for when something other than the parameters has changed, such as the sample rate.
+     */
+    void forceChanged()
+    {
+        forced = true;
+    }
+
+private:
+    vector<atomic<uint32_t>*> counters;
+    uint32_t lastSeenSum = 0;
+    bool forced = true;
+};
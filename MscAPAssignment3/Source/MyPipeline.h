@@ -0,0 +1,230 @@
+/*
+  ==============================================================================
+
+    MyPipeline.h
+
+    This optionally overlaps rendering the voices with running the effects.
+    Normally the voices are rendered and then the delay and reverb are run
+    over them, all on the audio thread, so a block takes as long as both put
+    together. With the pipeline on, a worker from the process wide scheduler
+    (MyScheduler.h) renders the voices for the current block while the audio
+    thread runs the effects over the voices rendered for the block before. When both the voices and the
+    reverb are heavy this roughly halves the time the audio thread spends on
+    each block on a multi-core machine.
+
+    The buffers are a double buffer:
+
+    * The back buffer: Only written by the worker while it renders a block.
+    * The front FIFO: The voices already rendered, always exactly one block
+      long. The effects take the oldest samples from here and the back
+      buffer is added on the end once the worker is done.
+
+    So the voices come out one block late, which is reported to the host as
+    latency. As the FIFO holds a whole block the host may still change its
+    block size from call to call, as long as it never goes over the size it
+    prepared with.
+
+    Everything is allocated when prepared. The voices are submitted as a job
+    due by the end of the block's real time duration, and if no worker has
+    started it by the time the effects are done it is rendered inline on the
+    audio thread instead. The job hands each voice out as a child job (see
+    MySynthesiser), so if a worker is still rendering the block the audio
+    thread takes the voices it has not started rather than waiting for them.
+    On Linux no locks are taken on the audio thread. On other platforms the
+    scheduler runs every job inline, so nothing is waited on there either.
+    The MIDI for the worker is copied into a buffer sized for
+    maxWorkerMidiEvents short messages. SysEx is left out, as the voices do
+    not use it, and any events past the limit are dropped and counted
+    rather than growing the buffer. The pipeline is only picked up
+    when the host prepares the plugin, as the latency cannot change
+    mid-playback, and only an instance with it on holds the scheduler.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "MyScheduler.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <JuceHeader.h>
+
+class MyPipeline : private MyScheduler::Job
+{
+public:
+    using VoiceFunction = std::function<void (juce::AudioBuffer<float>&, const juce::MidiBuffer&, int)>;
+
+    /// The most events handed to the worker in one block, enough for every note on all 16 channels to start and stop
+    static constexpr int maxWorkerMidiEvents = 16 * 128 * 2;
+
+    /// The most bytes of a message that is handed to the worker, enough for any message but SysEx
+    static constexpr int maxWorkerMidiMessageBytes = 3;
+
+    /**
+     Sizes the buffers if the pipeline is on. Not real time safe.
+
+     @param enabled True to render the voices on a worker
+     @param _sampleRate The sample rate, for working out each block's deadline
+     @param maxSamples The most samples that will be given to process at once
+     @param _numChannels The number of output channels
+     @param _renderVoices Called on a worker with a cleared buffer, its MIDI and a number of samples to render
+     */
+    void prepare (bool enabled, double _sampleRate, int maxSamples, int _numChannels, VoiceFunction _renderVoices)
+    {
+        latency = enabled ? maxSamples : 0;
+        sampleRate = _sampleRate;
+        numChannels = _numChannels;
+
+        if (latency == 0)
+        {
+            scheduler.reset();
+            return;
+        }
+
+        if (scheduler == nullptr)
+            scheduler = std::make_unique<juce::SharedResourcePointer<MyScheduler>>();
+
+        renderVoices = std::move (_renderVoices);
+        backBuffer.setSize (numChannels, maxSamples);
+        fifo.setSize (numChannels, maxSamples);
+        workerMidi.ensureSize (maxWorkerMidiBytes);
+
+        // The silence that makes up the latency
+        fifo.clear();
+    }
+
+    /**
+     Stops the pipeline until it is next prepared. Not real time safe.
+     */
+    void stop()
+    {
+        latency = 0;
+    }
+
+    /**
+     @return The latency in samples, which is a whole block while the pipeline is on
+     */
+    int getLatency() const
+    {
+        return latency;
+    }
+
+    /**
+     @return The scheduler the voices are rendered on, or nullptr if the pipeline is off
+     */
+    MyScheduler* getScheduler() const
+    {
+        return scheduler != nullptr ? &scheduler->getObject() : nullptr;
+    }
+
+    /**
+     @return The number of MIDI events dropped so far because a block had more than maxWorkerMidiEvents
+     */
+    int getNumDroppedMidiEvents() const
+    {
+        return numDroppedMidiEvents.load (std::memory_order_relaxed);
+    }
+
+    /**
+     @return True if the voices are rendered a block ahead, which is only once prepared and until stopped
+     */
+    bool isActive() const
+    {
+        return latency > 0;
+    }
+
+    /**
+     Submits the voices for this block to the scheduler and runs the effects over the voices from the last one.
+
+     @param buffer The buffer to fill
+     @param midi The MIDI events for the block
+     @param numSamples The number of samples to render, no more than given to prepare
+     @param applyEffects Called on the audio thread with the buffer and the number of samples to process
+     */
+    template <typename EffectsFunction>
+    void process (juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midi, int numSamples, EffectsFunction&& applyEffects)
+    {
+        copyWorkerMidi (midi, numSamples);
+        workerSamples = numSamples;
+        backBuffer.clear (0, numSamples);
+
+        double blockMs = 1000.0 * numSamples / sampleRate;
+        (*scheduler)->submit (*this, juce::Time::getMillisecondCounterHiRes() + blockMs);
+
+        int channelsToWrite = std::min (numChannels, buffer.getNumChannels());
+        for (int channel = 0; channel < channelsToWrite; channel++)
+            buffer.copyFrom (channel, 0, fifo, channel, 0, numSamples);
+
+        applyEffects (buffer, numSamples);
+
+        // A worker normally finishes first, in which case this does not wait at all
+        (*scheduler)->finish (*this);
+
+        for (int channel = 0; channel < numChannels; channel++)
+        {
+            float* samples = fifo.getWritePointer (channel);
+            const float* rendered = backBuffer.getReadPointer (channel);
+
+            std::copy (samples + numSamples, samples + latency, samples);
+            std::copy (rendered, rendered + numSamples, samples + latency - numSamples);
+        }
+    }
+
+private:
+    // Only held while the pipeline is on, so instances without it never start the workers
+    std::unique_ptr<juce::SharedResourcePointer<MyScheduler>> scheduler;
+
+    int latency = 0;
+    double sampleRate = 44100.0;
+    int numChannels = 2;
+
+    VoiceFunction renderVoices;
+
+    // Written by the job between submit and finish, read by the audio thread after
+    juce::AudioBuffer<float> backBuffer;
+    juce::MidiBuffer workerMidi;
+    int workerSamples = 0;
+
+    // The rendered voices waiting for the effects, only used by the audio thread
+    juce::AudioBuffer<float> fifo;
+
+    // juce::MidiBuffer stores each event as its sample position and size followed by its bytes
+    static constexpr int midiEventHeaderBytes = int (sizeof (juce::int32) + sizeof (juce::uint16));
+    static constexpr int maxWorkerMidiBytes = maxWorkerMidiEvents * (midiEventHeaderBytes + maxWorkerMidiMessageBytes);
+
+    std::atomic<int> numDroppedMidiEvents { 0 };
+
+    /**
+     Copies the block's MIDI for the worker without ever growing its buffer past the size it was prepared with.
+     */
+    void copyWorkerMidi (const juce::MidiBuffer& midi, int numSamples)
+    {
+        workerMidi.clear();
+        int numEvents = 0;
+
+        for (const auto metadata : midi)
+        {
+            if (metadata.samplePosition >= numSamples)
+                break;
+
+            if (metadata.numBytes > maxWorkerMidiMessageBytes)
+                continue;
+
+            if (numEvents == maxWorkerMidiEvents)
+            {
+                jassertfalse;
+                numDroppedMidiEvents.fetch_add (1, std::memory_order_relaxed);
+                continue;
+            }
+
+            workerMidi.addEvent (metadata.data, metadata.numBytes, metadata.samplePosition);
+            numEvents++;
+        }
+    }
+
+    void runJob() override
+    {
+        renderVoices (backBuffer, workerMidi, workerSamples);
+    }
+};
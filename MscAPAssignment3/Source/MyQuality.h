@@ -0,0 +1,112 @@
+/*
+  ==============================================================================
+
+    MyQuality.h
+
+    This holds the global quality mode, which trades DSP quality for CPU
+    across the whole plugin from a single parameter:
+
+    * Eco: For tracking with many instances. Filter coefficients are only
+      recalculated every 16 samples, the oscillators allow 30dB more aliasing
+      and never oversample, the delays interpolate linearly and the reverb
+      runs one shared tank for both channels, optionally at a half or a
+      quarter of the sample rate. Budget: 25% of the block.
+    * Live: The default. Filter coefficients every sample, as before the
+      quality modes, so filter modulation sounds the same. The alias
+      threshold as set, 2x oversampling where needed, cubic delay
+      interpolation and the full stereo reverb. Budget: 50% of the block.
+    * Render: For final mixdowns. 40dB less aliasing than the threshold and
+      everything else as Live. There is
+      no budget since offline rendering can take as long as it needs.
+
+    The budget is the share of the block's real time duration that the synth
+    is expected to stay within in that mode.
+
+    The CPU governor (MyGovernor.h) can lower any of these further while the
+    load is over budget.
+
+    When render when offline is on, Render is used whenever the host is
+    bouncing (AudioProcessor::isNonRealtime) regardless of the chosen mode.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class MyQuality
+{
+public:
+    enum class Mode
+    {
+        eco,
+        live,
+        render
+    };
+
+    struct Settings
+    {
+        /// How many samples pass between recalculations of modulated filter coefficients
+        int controlInterval;
+        /// Added to the oscillator alias threshold, in dB
+        float aliasThresholdOffset;
+        /// Whether the oscillators may oversample to reduce aliasing
+        bool allowOversampling;
+        /// True for cubic delay interpolation, false for linear
+        bool cubicDelayInterpolation;
+        /// True for a reverb tank per channel, false for one tank shared by both
+        bool stereoReverb;
+        /// The share of the block's duration the synth should take, or 0 for no limit
+        float cpuBudget;
+        /// The most unison lanes an oscillator may use
+        int maxUnison;
+        /// The most voices that may be in their release at once, the quietest beyond this are cut
+        int maxReleasingVoices;
+    };
+
+    /**
+     Works out the mode to use for the coming block. Called by the processor at the start of every block.
+
+     @param chosenMode The index of the mode chosen by the user
+     @param renderWhenOffline True if Render should be used while bouncing
+     @param isNonRealtime True if the host is rendering offline
+     @param governorLevel How many steps of quality the CPU governor has taken away
+     */
+    void update (int chosenMode, bool renderWhenOffline, bool isNonRealtime, int governorLevel)
+    {
+        mode = (renderWhenOffline && isNonRealtime) ? Mode::render : Mode (chosenMode);
+
+        static constexpr Settings modeSettings[] = {
+            { 16, 30.0f, false, false, false, 0.25f, 16, 128 },  // Eco
+            { 1, 0.0f, true, true, true, 0.5f, 16, 128 },        // Live
+            { 1, -40.0f, true, true, true, 0.0f, 16, 128 }       // Render
+        };
+
+        settings = modeSettings[int (mode)];
+
+        if (governorLevel >= 1)
+            settings.controlInterval *= 4;
+
+        if (governorLevel >= 2)
+        {
+            settings.maxUnison = 4;
+            settings.allowOversampling = false;
+        }
+
+        if (governorLevel >= 3)
+            settings.maxReleasingVoices = 4;
+    }
+
+    Mode getMode() const
+    {
+        return mode;
+    }
+
+    const Settings& getSettings() const
+    {
+        return settings;
+    }
+
+private:
+    Mode mode = Mode::live;
+    Settings settings = { 1, 0.0f, true, true, true, 0.5f, 16, 128 };
+};
@@ -17,11 +17,38 @@
     * reverbDryLevel: How much of the original signal is in the output
     * reverbWidth: A factor controlling the stereo spread of the reverb
 
+    In the Eco quality mode a second reverb is used that runs a single tank on
+    the mono sum of the channels, which is added back to both channels. This
+    halves the cost at the expense of the stereo width.
+
+    With qualityEcoReverbRate at Half or Quarter, the Eco tank also runs at
+    that fraction of the sample rate. The mono sum is decimated with one or
+    two half-band stages (MyHalfBand.h), run through the tank and
+    interpolated back up, while the dry signal stays at the full rate. The
+    tail has little above 10kHz, so at 44.1 or 48kHz Half loses little and
+    Quarter darkens it, more so with low damping. The rate is picked up when
+    the host prepares the plugin, as the tank is sized for it then.
+
+    Decimating a block that is not a multiple of the factor gives one low
+    rate sample more in some blocks than others, so the wet signal comes
+    back through a short FIFO that holds any samples made ahead of the
+    block. The filters delay the wet signal by about 1ms, which is not
+    reported to the host as the reverb is diffuse anyway.
+
+    Both reverbs run wet only and the dry signal is mixed back in here, so
+    that switching the reverb on or off can fade it rather than cut it (see
+    MyBypass.h). With reverbTails on, the tank is left to ring out after the
+    reverb is switched off. The tanks are only reset once the reverb can no
+    longer be heard.
+
   ==============================================================================
 */
 
 #pragma once
 
+#include "MyArena.h"
+#include "MyBypass.h"
+#include "MyHalfBand.h"
 #include "MyParameters.h"
 #include <JuceHeader.h>
 
@@ -33,11 +60,35 @@ public:
      
      @param _params A pointer to the user editable parameters.
      */
-    MyReverb (MyParameters* _params) : params (_params)
+    MyReverb (MyParameters* _params) :
+    params (_params),
+    paramWatcher (_params, { "reverb_room_size", "reverb_damping", "reverb_wet_level", "reverb_dry_level", "reverb_width" })
     {
         // empty
     }
 
+    /**
+     Takes the wet and fade gain buffers from the arena. Called from the arena's layout function, before prepareToPlay.
+
+     @param arena The arena being laid out
+     @param maxBlockSize The largest block expected
+     */
+    void allocate (MyArena& arena, int maxBlockSize)
+    {
+        scratchSize = std::max (maxBlockSize, 1);
+        wetLeft = arena.allocate<float> ((size_t) scratchSize);
+        wetRight = arena.allocate<float> ((size_t) scratchSize);
+        inputGains = arena.allocate<float> ((size_t) scratchSize);
+        wetGains = arena.allocate<float> ((size_t) scratchSize);
+
+        // Each stage makes at most one sample more than the exact fraction of the rate
+        halfRate = arena.allocate<float> ((size_t) (scratchSize / 2) + 2);
+        quarterRate = arena.allocate<float> ((size_t) (scratchSize / 4) + 2);
+        reducedFifo = arena.allocate<float> ((size_t) (scratchSize + maxRateFactor));
+        halfBandStages[0].allocate (arena, scratchSize + 2);
+        halfBandStages[1].allocate (arena, (scratchSize / 2) + 1);
+    }
+
     /**
      Must by called before use to set the sample rate and ensure the reverb is initially in a reset state
      
@@ -45,20 +96,39 @@ public:
      */
     void prepareToPlay (double sampleRate)
     {
+        // The Eco tank is the only one that can run at a lower rate
+        static constexpr int rateFactors[] = { 1, 2, 4 };
+        rateFactor = rateFactors[params->qualityEcoReverbRate->getIndex()];
+
         reverb.setSampleRate (sampleRate);
+        monoReverb.setSampleRate (sampleRate / rateFactor);
+        resetReducedRate();
+        bypass.prepare (sampleRate, params->reverbOn->get());
+        tailSamples = int (sampleRate * tailSeconds);
+        paramWatcher.forceChanged();
         reset();
     }
 
     /**
-     Applies the reveb to the given buffer if the reverb is turned on, otherwise simply returns without any processing of the buffer.
+     @return How long the tank rings on after the input stops. juce::Reverb's combs feed back by 0.7 plus 0.28 times
+             the room size, and the longest is 1617 samples at 44.1kHz. Damping only shortens this.
+     */
+    double getTailSeconds() const
+    {
+        return MyBypass::getFeedbackTailSeconds (longestCombSeconds, 0.7 + (0.28 * *params->reverbRoomSize));
+    }
+
+    /**
+     Applies the reveb to the given buffer if the reverb is turned on or still fading out, otherwise simply returns without any processing of the buffer.
      
      @param buffer The buffer to apply the reverb to
      @param numSamples The number of samples in the buffer
      */
     void apply (juce::AudioBuffer<float>& buffer, int numSamples)
     {
-        if (! params->reverbOn->get())
+        if (! bypass.beginBlock (params->reverbOn->get(), params->reverbTails->get()))
         {
+            // By now the reverb has faded or rung out, so resetting it can not be heard
             if (! isReset)
                 reset();
             return;
@@ -68,10 +138,51 @@ public:
         isReset = false;
 
         updateParams();
-        if (buffer.getNumChannels() < 2)
-            reverb.processMono (buffer.getWritePointer (0), numSamples);
-        else
-            reverb.processStereo (buffer.getWritePointer (0), buffer.getWritePointer (1), numSamples);
+
+        float* left = buffer.getWritePointer (0);
+        float* right = buffer.getNumChannels() > 1 ? buffer.getWritePointer (1) : nullptr;
+        bool stereo = right != nullptr && params->quality.getSettings().stereoReverb;
+        float dryGain = reverbParams.dryLevel * dryScaleFactor;
+        float peak = 0.0f;
+
+        for (int start = 0; start < numSamples; start += scratchSize)
+        {
+            int blockSize = std::min (scratchSize, numSamples - start);
+            bypass.fillGains (inputGains, wetGains, blockSize);
+
+            if (right == nullptr)
+            {
+                juce::FloatVectorOperations::multiply (wetLeft, left + start, inputGains, blockSize);
+                reverb.processMono (wetLeft, blockSize);
+            }
+            else if (stereo)
+            {
+                juce::FloatVectorOperations::multiply (wetLeft, left + start, inputGains, blockSize);
+                juce::FloatVectorOperations::multiply (wetRight, right + start, inputGains, blockSize);
+                reverb.processStereo (wetLeft, wetRight, blockSize);
+            }
+            else
+            {
+                // The mono sum of the channels for the single tank used in Eco
+                juce::FloatVectorOperations::add (wetLeft, left + start, right + start, blockSize);
+                juce::FloatVectorOperations::multiply (wetLeft, 0.5f, blockSize);
+                juce::FloatVectorOperations::multiply (wetLeft, inputGains, blockSize);
+
+                if (rateFactor == 1)
+                    monoReverb.processMono (wetLeft, blockSize);
+                else
+                    processReducedRate (blockSize);
+            }
+
+            mixChannel (left + start, wetLeft, blockSize, dryGain);
+            if (right != nullptr)
+                mixChannel (right + start, stereo ? wetRight : wetLeft, blockSize, dryGain);
+
+            auto wetRange = juce::FloatVectorOperations::findMinAndMax (wetLeft, blockSize);
+            peak = std::max (peak, std::max (-wetRange.getStart(), wetRange.getEnd()));
+        }
+
+        bypass.endBlock (peak, numSamples, tailSamples);
     }
 
 private:
@@ -80,20 +191,116 @@ private:
     juce::Reverb reverb;
     juce::Reverb::Parameters reverbParams;
 
+    // The reverb used in Eco, on the mono sum of the channels.
+    juce::Reverb monoReverb;
+
+    // Scratch buffers in the processor's arena for the wet signal and the fade gains
+    float* wetLeft = nullptr;
+    float* wetRight = nullptr;
+    float* inputGains = nullptr;
+    float* wetGains = nullptr;
+    int scratchSize = 0;
+
+    // The Eco tank's rate is the sample rate divided by this
+    static constexpr int maxRateFactor = 4;
+    int rateFactor = 1;
+
+    // The resampling for the Eco tank, see MyHalfBand.h. The FIFO holds the wet signal back at the full rate.
+    MyHalfBand halfBandStages[2];
+    float* halfRate = nullptr;
+    float* quarterRate = nullptr;
+    float* reducedFifo = nullptr;
+    int fifoCount = 0;
+
+    // juce::Reverb scales the dry level by this internally, so the dry path here matches it.
+    static constexpr float dryScaleFactor = 2.0f;
+
+    MyParameterWatcher paramWatcher;
+
+    MyBypass bypass;
+
+    // The longest of juce::Reverb's comb filters, which it scales with the sample rate
+    static constexpr double longestCombSeconds = 1617.0 / 44100.0;
+
+    // Longer than any of the tank's comb filters, so a silent stretch this long means the tail has died away
+    static constexpr double tailSeconds = 0.2;
+    int tailSamples = 0;
+
     // Helper flag to avoid resetting every time the filter is off.
     bool isReset = false;
 
     /**
-     Simply maps the user params to the reverb parameters object and applies it to the reverb object.
+     Simply maps the user params to the reverb parameters object and applies it to the reverb object. This is skipped
+     when none of the params have changed since the reverb recalculates its gains every time they are set.
      */
     void updateParams()
     {
+        if (! paramWatcher.hasChanged())
+            return;
+
         reverbParams.roomSize = *params->reverbRoomSize;
         reverbParams.damping = *params->reverbDamping;
         reverbParams.wetLevel = *params->reverbWetLevel;
         reverbParams.dryLevel = *params->reverbDryLevel;
         reverbParams.width = *params->reverbWidth;
-        reverb.setParameters (reverbParams);
+
+        // The dry level is kept for mixChannel, the reverbs themselves run wet only
+        juce::Reverb::Parameters wetParams = reverbParams;
+        wetParams.dryLevel = 0.0f;
+        reverb.setParameters (wetParams);
+        monoReverb.setParameters (wetParams);
+    }
+
+    /**
+     Mixes the wet signal into a channel, fading the dry level from unity and the wet signal in with the bypass gains.
+
+     @param channel The channel, holding the dry signal
+     @param wet The reverb's output
+     @param numSamples The number of samples
+     @param dryGain The dry level with the reverb fully on
+     */
+    void mixChannel (float* channel, const float* wet, int numSamples, float dryGain)
+    {
+        for (int i = 0; i < numSamples; i++)
+            channel[i] = (channel[i] * (1.0f + (inputGains[i] * (dryGain - 1.0f)))) + (wetGains[i] * wet[i]);
+    }
+
+    /**
+     Runs the Eco tank over wetLeft at the reduced rate, leaving the wet signal in wetLeft.
+
+     @param numSamples The number of samples at the full rate
+     */
+    void processReducedRate (int numSamples)
+    {
+        float* tankSamples = halfRate;
+        int numTankSamples = halfBandStages[0].decimate (wetLeft, numSamples, halfRate);
+        if (rateFactor == 4)
+        {
+            tankSamples = quarterRate;
+            numTankSamples = halfBandStages[1].decimate (halfRate, numTankSamples, quarterRate);
+        }
+
+        monoReverb.processMono (tankSamples, numTankSamples);
+
+        if (rateFactor == 4)
+            halfBandStages[1].interpolate (quarterRate, numTankSamples, halfRate);
+
+        halfBandStages[0].interpolate (halfRate, numTankSamples * (rateFactor / 2), reducedFifo + fifoCount);
+        fifoCount += numTankSamples * rateFactor;
+
+        // The decimators make a sample on the first input sample of each group, so there are always enough
+        jassert (fifoCount >= numSamples);
+        std::copy (reducedFifo, reducedFifo + numSamples, wetLeft);
+        std::copy (reducedFifo + numSamples, reducedFifo + fifoCount, reducedFifo);
+        fifoCount -= numSamples;
+    }
+
+    void resetReducedRate()
+    {
+        for (auto& stage : halfBandStages)
+            stage.reset();
+
+        fifoCount = 0;
     }
 
     /**
@@ -102,6 +309,8 @@ private:
     void reset()
     {
         reverb.reset();
+        monoReverb.reset();
+        resetReducedRate();
         isReset = true;
     }
 };
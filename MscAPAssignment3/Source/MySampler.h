@@ -0,0 +1,461 @@
+/*
+  ==============================================================================
+
+    MySampler.h
+
+    This implements the sample playback used by the Sample oscillator type.
+    Samples can be hundreds of megabytes, so they are never fully loaded into
+    memory:
+
+    * MySample: A loaded file. WAV files are memory-mapped so the operating
+      system shares the pages between every instance that plays the same
+      file. Other formats (FLAC etc.) are decoded from disk on demand. Only
+      the attack (the first preloadLength frames) is held in memory, mixed to
+      mono, so a note can start instantly.
+    * MySampleStream: One playback position for one oscillator in one voice.
+      Everything after the attack comes through a lock-free single producer,
+      single consumer ring buffer that is indexed by the frame number within
+      the sample.
+    * MySampleStreamer: The background disk thread that keeps every stream's
+      ring buffer topped up. The audio thread never reads the file itself.
+      While a sample is loaded the disk thread checks the streams every few
+      milliseconds, far more often than a ring can run dry, so the audio
+      thread never has to wake it.
+
+    A new sample is handed to the disk thread, which publishes it through an
+    atomic pointer. The audio thread picks it up at the start of its next
+    block, stopping every stream, and acknowledges it. Until then the disk
+    thread leaves the streams alone and keeps the old sample alive, so no
+    lock is shared with the audio thread and none is held while reading the
+    disk.
+
+    Restarting a stream bumps a generation counter that is packed into the
+    same atomic as the position, so the audio thread can never mistake the
+    frames the disk thread wrote for a previous note as belonging to the new
+    one. If the disk thread falls behind, the stream outputs silence and holds
+    its place until the frames arrive.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <JuceHeader.h>
+
+class MySample
+{
+public:
+    /// The MIDI note the sample plays back at its original speed
+    static constexpr int rootNote = 60;
+
+    /// How many frames of the attack are kept in memory, about 1.5 seconds at 44.1kHz
+    static constexpr int preloadLength = 65536;
+
+    /**
+     Opens a sample file and preloads its attack.
+
+     @param file The WAV, FLAC or other file to open
+     @param formatManager The formats that can be read, with the basic formats registered
+     @return The sample, or nullptr if the file could not be read
+     */
+    static std::shared_ptr<MySample> load (const juce::File& file, juce::AudioFormatManager& formatManager)
+    {
+        std::unique_ptr<juce::AudioFormatReader> reader;
+
+        if (file.hasFileExtension ("wav"))
+        {
+            juce::WavAudioFormat wavFormat;
+            std::unique_ptr<juce::MemoryMappedAudioFormatReader> mappedReader (wavFormat.createMemoryMappedReader (file));
+
+            if (mappedReader != nullptr && mappedReader->mapEntireFile())
+                reader = std::move (mappedReader);
+        }
+
+        if (reader == nullptr)
+            reader.reset (formatManager.createReaderFor (file));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return nullptr;
+
+        std::shared_ptr<MySample> sample (new MySample (std::move (reader)));
+        sample->preloadAttack();
+        return sample;
+    }
+
+    juce::int64 getLength() const
+    {
+        return length;
+    }
+
+    double getSampleRate() const
+    {
+        return sampleRate;
+    }
+
+    /**
+     @return How many frames from the start are always available, up to preloadLength
+     */
+    int getNumPreloaded() const
+    {
+        return (int) preload.size();
+    }
+
+    /**
+     @param index A frame below getNumPreloaded()
+     */
+    float getPreloadedFrame (juce::int64 index) const
+    {
+        return preload[(size_t) index];
+    }
+
+    /**
+     Reads frames from the file, mixed to mono. This can block on the disk so must only be called from the disk thread,
+     or while loading.
+
+     @param output Where to write the frames
+     @param startFrame The first frame to read
+     @param numFrames How many frames to read
+     @param scratch A stereo buffer of at least numFrames samples to decode into
+     */
+    void readMono (float* output, juce::int64 startFrame, int numFrames, juce::AudioBuffer<float>& scratch)
+    {
+        reader->read (&scratch, 0, numFrames, startFrame, true, true);
+
+        juce::FloatVectorOperations::copy (output, scratch.getReadPointer (0), numFrames);
+        juce::FloatVectorOperations::add (output, scratch.getReadPointer (1), numFrames);
+        juce::FloatVectorOperations::multiply (output, 0.5f, numFrames);
+    }
+
+private:
+    std::unique_ptr<juce::AudioFormatReader> reader;
+    juce::int64 length;
+    double sampleRate;
+
+    std::vector<float> preload;
+
+    explicit MySample (std::unique_ptr<juce::AudioFormatReader> _reader)
+        : reader (std::move (_reader)), length (reader->lengthInSamples), sampleRate (reader->sampleRate)
+    {
+    }
+
+    void preloadAttack()
+    {
+        constexpr int chunkSize = 4096;
+        juce::AudioBuffer<float> scratch (2, chunkSize);
+
+        preload.resize ((size_t) std::min (length, juce::int64 (preloadLength)));
+
+        for (size_t start = 0; start < preload.size(); start += chunkSize)
+        {
+            int numFrames = (int) std::min (preload.size() - start, size_t (chunkSize));
+            readMono (preload.data() + start, juce::int64 (start), numFrames, scratch);
+        }
+    }
+};
+
+//==============================================================================
+class MySampleStream
+{
+public:
+    /// The number of frames after the attack that are buffered ahead of the playback position
+    static constexpr int ringSize = 32768;
+
+    /**
+     Restarts playback from the beginning of the sample. Audio thread only.
+     */
+    void start()
+    {
+        if (sample == nullptr)
+            return;
+
+        generation = (generation + 1) & generationMask;
+        position = 0.0;
+
+        // readFrame is stored before the request so the disk thread never sees the new generation with the old position.
+        readFrame.store (0, std::memory_order_relaxed);
+        request.store (pack (generation, sample->getNumPreloaded()), std::memory_order_release);
+    }
+
+    /**
+     Renders the sample with linear interpolation, stepping the position by the playback rate that getRate returns for
+     each sample. Audio thread only.
+
+     @param output Where to write the samples
+     @param numSamples The number of samples to write
+     @param getRate Called for each sample, returns how many frames of the sample to move on by
+     */
+    template <typename RateFunction>
+    void render (float* output, int numSamples, RateFunction getRate)
+    {
+        if (sample == nullptr)
+        {
+            juce::FloatVectorOperations::clear (output, numSamples);
+            return;
+        }
+
+        juce::int64 length = sample->getLength();
+        juce::int64 available = std::min (getAvailableEnd(), length);
+
+        for (int i = 0; i < numSamples; i++)
+        {
+            float rate = getRate (i);
+            auto index = juce::int64 (position);
+
+            if (index + 1 < available)
+            {
+                float fraction = float (position - double (index));
+                float current = getFrame (index);
+                output[i] = current + (fraction * (getFrame (index + 1) - current));
+                position += rate;
+            }
+            else
+            {
+                // Either played to the end or the disk thread has fallen behind, in which case this waits for it
+                output[i] = 0.0f;
+            }
+        }
+
+        readFrame.store (juce::int64 (position), std::memory_order_release);
+    }
+
+    /**
+     @return The sample being played, or nullptr if none is loaded
+     */
+    const MySample* getSample() const
+    {
+        return sample;
+    }
+
+private:
+    friend class MySampleStreamer;
+
+    static constexpr int ringMask = ringSize - 1;
+    static constexpr int generationShift = 48;
+    static constexpr juce::uint64 generationMask = 0xffff;
+    static constexpr juce::uint64 frameMask = (juce::uint64 (1) << generationShift) - 1;
+
+    MySample* sample = nullptr;
+
+    // Only touched by the audio thread
+    juce::uint64 generation = 0;
+    double position = 0.0;
+
+    // Written by the audio thread, read by the disk thread
+    std::atomic<juce::uint64> request { 0 };
+    std::atomic<juce::int64> readFrame { 0 };
+
+    // Written by the disk thread, read by the audio thread
+    std::atomic<juce::uint64> written { 0 };
+
+    float ring[ringSize];
+
+    static juce::uint64 pack (juce::uint64 generation, juce::int64 frame)
+    {
+        return (generation << generationShift) | (juce::uint64 (frame) & frameMask);
+    }
+
+    juce::int64 getAvailableEnd() const
+    {
+        juce::uint64 current = written.load (std::memory_order_acquire);
+
+        if ((current >> generationShift) != generation)
+            return sample->getNumPreloaded();
+
+        return juce::int64 (current & frameMask);
+    }
+
+    float getFrame (juce::int64 index) const
+    {
+        if (index < sample->getNumPreloaded())
+            return sample->getPreloadedFrame (index);
+
+        return ring[index & ringMask];
+    }
+
+    /**
+     Sets a new sample, leaving the stream stopped. Audio thread only, while the disk thread is waiting for the
+     new sample to be acknowledged and so is not filling any stream.
+     */
+    void setSample (MySample* _sample)
+    {
+        sample = _sample;
+        generation = (generation + 1) & generationMask;
+        position = sample != nullptr ? double (sample->getLength()) : 0.0;
+
+        readFrame.store (juce::int64 (position), std::memory_order_relaxed);
+        request.store (pack (generation, juce::int64 (position)), std::memory_order_relaxed);
+        written.store (pack (generation, juce::int64 (position)), std::memory_order_relaxed);
+    }
+
+    /**
+     Tops up the ring buffer from the file. Disk thread only.
+
+     @param maxFrames The most frames to read in one go
+     @param scratch A stereo buffer of at least maxFrames samples
+     @return The number of frames read
+     */
+    int fill (int maxFrames, juce::AudioBuffer<float>& scratch)
+    {
+        juce::uint64 currentRequest = request.load (std::memory_order_acquire);
+        juce::uint64 requestGeneration = currentRequest >> generationShift;
+        juce::int64 startFrame = juce::int64 (currentRequest & frameMask);
+
+        // The disk thread is the only writer so a relaxed load sees its own last store.
+        juce::uint64 current = written.load (std::memory_order_relaxed);
+        juce::int64 writeEnd = (current >> generationShift) == requestGeneration ? juce::int64 (current & frameMask) : startFrame;
+
+        juce::int64 oldestNeeded = std::max (readFrame.load (std::memory_order_acquire), startFrame);
+        juce::int64 freeSpace = ringSize - (writeEnd - oldestNeeded);
+        int numFrames = (int) std::max (juce::int64 (0), std::min ({ freeSpace, juce::int64 (maxFrames), sample->getLength() - writeEnd }));
+
+        int done = 0;
+        while (done < numFrames)
+        {
+            // Split where the ring wraps around
+            int ringIndex = int ((writeEnd + done) & ringMask);
+            int part = std::min (numFrames - done, ringSize - ringIndex);
+            sample->readMono (ring + ringIndex, writeEnd + done, part, scratch);
+            done += part;
+        }
+
+        written.store (pack (requestGeneration, writeEnd + numFrames), std::memory_order_release);
+        return numFrames;
+    }
+};
+
+//==============================================================================
+class MySampleStreamer : private juce::Thread
+{
+public:
+    MySampleStreamer() : juce::Thread ("Sample Streamer")
+    {
+    }
+
+    ~MySampleStreamer() override
+    {
+        stopThread (1000);
+    }
+
+    /**
+     Creates a stream for one oscillator. Must be called before the first sample is set.
+
+     @return The stream, owned by the streamer
+     */
+    MySampleStream* addStream()
+    {
+        streams.push_back (std::make_unique<MySampleStream>());
+        return streams.back().get();
+    }
+
+    /**
+     Hands a new sample to the disk thread. Every stream stops at the start of the first audio block after the disk
+     thread has published it. The old sample is freed on the disk thread once the audio thread has let go of it.
+
+     @param newSample The sample to play, or nullptr for none
+     */
+    void setSample (std::shared_ptr<MySample> newSample)
+    {
+        {
+            const juce::ScopedLock sl (incomingLock);
+            incoming = std::move (newSample);
+            hasIncoming = true;
+        }
+
+        if (! isThreadRunning())
+            startThread();
+
+        notify();
+    }
+
+    /**
+     Picks up a newly published sample, stopping every stream. Called by the synthesiser on the audio thread before
+     any notes are started.
+     */
+    void beginBlock()
+    {
+        MySample* next = published.load (std::memory_order_acquire);
+        if (next == active)
+            return;
+
+        for (auto& stream : streams)
+            stream->setSample (next);
+
+        active = next;
+        acknowledged.store (next, std::memory_order_release);
+    }
+
+private:
+    static constexpr int chunkSize = 4096;
+
+    /// How often the disk thread tops the streams up, well inside the time a ring of ringSize frames lasts
+    static constexpr int pollIntervalMs = 5;
+
+    std::vector<std::unique_ptr<MySampleStream>> streams;
+
+    // Only touched by the disk thread, apart from incoming which the message thread hands over under the lock
+    std::shared_ptr<MySample> sample;
+    std::shared_ptr<MySample> retired;
+    std::shared_ptr<MySample> incoming;
+    bool hasIncoming = false;
+    juce::CriticalSection incomingLock;
+
+    // Written by the disk thread, read by the audio thread
+    std::atomic<MySample*> published { nullptr };
+
+    // Written by the audio thread, read by the disk thread
+    std::atomic<MySample*> acknowledged { nullptr };
+
+    // Only touched by the audio thread
+    MySample* active = nullptr;
+
+    /**
+     @return True while the audio thread has not yet picked up the published sample
+     */
+    bool isSwapping() const
+    {
+        return acknowledged.load (std::memory_order_acquire) != published.load (std::memory_order_relaxed);
+    }
+
+    /**
+     Publishes the incoming sample once the last one has been picked up, freeing the one before it.
+     */
+    void takeIncomingSample()
+    {
+        if (isSwapping())
+            return;
+
+        retired.reset();
+
+        const juce::ScopedLock sl (incomingLock);
+        if (! hasIncoming)
+            return;
+
+        retired = std::move (sample);
+        sample = std::move (incoming);
+        hasIncoming = false;
+        published.store (sample.get(), std::memory_order_release);
+    }
+
+    void run() override
+    {
+        juce::AudioBuffer<float> scratch (2, chunkSize);
+
+        while (! threadShouldExit())
+        {
+            takeIncomingSample();
+
+            int framesRead = 0;
+            if (sample != nullptr && ! isSwapping())
+                for (auto& stream : streams)
+                    framesRead += stream->fill (chunkSize, scratch);
+
+            // Polled rather than woken by the audio thread, which would mean taking the thread's lock there. With
+            // nothing to stream and nothing waiting to be picked up, only setSample wakes it.
+            if (framesRead == 0)
+                wait (sample != nullptr || isSwapping() ? pollIntervalMs : -1);
+        }
+    }
+};
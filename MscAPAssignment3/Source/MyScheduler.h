@@ -0,0 +1,396 @@
+/*
+  ==============================================================================
+
+    MyScheduler.h
+
+    This is one pool of worker threads shared by every instance of the plugin
+    in the host process, so that work moved off the audio thread, such as
+    rendering the voices a block ahead (MyPipeline.h), never has more threads
+    behind it than there are cores however many instances are open.
+
+    * There is one worker per physical core. They can be pinned to a core
+      each with pinWorkers, which is off by default. A SCHED_FIFO audio
+      thread waiting in finish only yields to threads of its own priority,
+      so if it is on the same core as a pinned worker that is part way
+      through its job, the worker cannot run until the kernel's real time
+      throttling steps in. Unpinned, the kernel moves the worker to another
+      core instead.
+    * On Linux the workers ask for SCHED_FIFO real time priority. This needs
+      CAP_SYS_NICE or a high enough RLIMIT_RTPRIO. A worker at normal
+      priority can be held up by anything else on the machine, so jobs are
+      only handed to the pool while at least one worker got real time
+      priority. Otherwise, and on other platforms, every job is run inline.
+    * Jobs go into a fixed number of slots, each with the time the job must
+      be done by. A free worker always takes the job with the earliest
+      deadline, so the instance whose callback is due first is served first.
+    * A job is only ever run once: by a worker if one takes it from its slot,
+      otherwise by the instance itself when it needs the result. So when the
+      pool is saturated, or every slot is full, the job is simply rendered
+      inline on the audio thread as if there were no pool at all.
+    * A job can split itself into child jobs, such as one for each voice.
+      While a worker runs the parent, the thread waiting for it takes any
+      children no worker has started, so it only ever waits for jobs that
+      are already running.
+
+    Submitting and finishing a job never allocates. A worker with nothing
+    to do parks, and a submitted job only wakes a worker if one is parked.
+    On Linux the wake is a POSIX semaphore post, which takes no lock. Other
+    platforms use a juce::WaitableEvent, which does, but they never queue
+    jobs. Idle workers do not spin first, as a spinning SCHED_FIFO thread
+    would keep every normal priority thread off its core. The scheduler is
+    held with juce::SharedResourcePointer, so the workers exist while any
+    instance is open.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <JuceHeader.h>
+
+#if JUCE_LINUX
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#endif
+
+class MyScheduler
+{
+public:
+    /// The most jobs that can be waiting at once, beyond this they are run inline
+    static constexpr int numSlots = 256;
+
+    /// The SCHED_FIFO priority asked for, below the priorities hosts and JACK usually give audio callbacks
+    static constexpr int realtimePriority = 60;
+
+    /// True to pin worker i to CPU i, for the first 32 CPUs. See the top of this file for why it is off.
+    static constexpr bool pinWorkers = false;
+
+    /**
+     Something to be run on a worker. The owner keeps it alive from submit until finish returns.
+     */
+    class Job
+    {
+    public:
+        virtual ~Job() = default;
+
+        /**
+         Does the work, on a worker or on the thread that calls finish.
+         */
+        virtual void runJob() = 0;
+
+    private:
+        friend class MyScheduler;
+
+        // The slot the job is waiting in, or -1 if it could not be queued
+        int slot = -1;
+        double deadline = 0.0;
+        std::atomic<bool> done { true };
+    };
+
+    MyScheduler()
+    {
+        int numWorkers = std::max (1, juce::SystemStats::getNumPhysicalCpus());
+        for (int i = 0; i < numWorkers; i++)
+        {
+            workers.push_back (std::make_unique<Worker> (*this, i));
+            workers.back()->startThread();
+        }
+    }
+
+    ~MyScheduler()
+    {
+        for (auto& worker : workers)
+            worker->signalThreadShouldExit();
+
+        // Each post wakes one worker
+        for (size_t i = 0; i < workers.size(); i++)
+            workAvailable.post();
+
+        for (auto& worker : workers)
+            worker->stopThread (1000);
+    }
+
+    /**
+     Queues a job for the workers, or leaves it to be run by finish if no worker has real time priority. Real time
+     safe.
+
+     @param job The job, which must not already be queued
+     @param deadline When the job must be done by, on the juce::Time::getMillisecondCounterHiRes clock
+     */
+    void submit (Job& job, double deadline)
+    {
+        queue (job, deadline, nullptr);
+    }
+
+    /**
+     Queues a job from inside another job's runJob, due when that job is. The thread finishing the outer job may take
+     it if no worker has started it. Real time safe.
+
+     @param job The job, which must not already be queued
+     */
+    void submitChild (Job& job)
+    {
+        Job* parent = getCurrentJob();
+        queue (job, parent != nullptr ? parent->deadline : juce::Time::getMillisecondCounterHiRes(), parent);
+    }
+
+    /**
+     Waits for a submitted job, running it here if no worker has started it. While a worker runs it, its children that
+     no worker has started are run here too, so this only ever waits for jobs that are already running. Real time
+     safe.
+
+     @param job The job given to submit or submitChild
+     */
+    void finish (Job& job)
+    {
+        // Taking the job back out of its slot means no worker can run it, so it is run inline
+        if (job.slot < 0 || takeFromSlot (job.slot, &job))
+        {
+            run (job);
+            return;
+        }
+
+        while (! job.done.load (std::memory_order_acquire))
+        {
+            if (! runEarliestJob (&job))
+                juce::Thread::yield();
+        }
+    }
+
+private:
+    // The deadline and parent are only meaningful while the slot holds a job
+    struct Slot
+    {
+        std::atomic<Job*> job { nullptr };
+        std::atomic<double> deadline { 0.0 };
+        std::atomic<const Job*> parent { nullptr };
+    };
+
+    /**
+     A counting semaphore, so a post is never lost between a worker deciding to park and parking.
+     */
+    class Semaphore
+    {
+    public:
+#if JUCE_LINUX
+        Semaphore() { sem_init (&semaphore, 0, 0); }
+        ~Semaphore() { sem_destroy (&semaphore); }
+
+        void post() { sem_post (&semaphore); }
+
+        void wait (int timeoutMs)
+        {
+            timespec until {};
+            clock_gettime (CLOCK_REALTIME, &until);
+            until.tv_sec += timeoutMs / 1000;
+            until.tv_nsec += (timeoutMs % 1000) * 1000000L;
+            if (until.tv_nsec >= 1000000000L)
+            {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+
+            sem_timedwait (&semaphore, &until);
+        }
+
+    private:
+        sem_t semaphore;
+#else
+        void post() { event.signal(); }
+        void wait (int timeoutMs) { event.wait (timeoutMs); }
+
+    private:
+        juce::WaitableEvent event;
+#endif
+    };
+
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker (MyScheduler& _scheduler, int _index)
+            : juce::Thread ("Scheduler Worker " + juce::String (_index)), scheduler (_scheduler), index (_index)
+        {
+        }
+
+        void run() override
+        {
+            if (pinWorkers && index < 32)
+                setCurrentThreadAffinityMask (juce::uint32 (1) << index);
+
+#if JUCE_LINUX
+            // Fails without permission, in which case the worker stays at normal priority and is not counted
+            sched_param param {};
+            param.sched_priority = juce::jlimit (sched_get_priority_min (SCHED_FIFO), sched_get_priority_max (SCHED_FIFO), realtimePriority);
+            bool realtime = pthread_setschedparam (pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+            bool realtime = false;
+#endif
+            if (realtime)
+                scheduler.numRealtimeWorkers.fetch_add (1, std::memory_order_relaxed);
+
+            while (! threadShouldExit())
+            {
+                if (! scheduler.runEarliestJob (nullptr))
+                    scheduler.park();
+            }
+
+            if (realtime)
+                scheduler.numRealtimeWorkers.fetch_sub (1, std::memory_order_relaxed);
+        }
+
+    private:
+        MyScheduler& scheduler;
+        int index;
+    };
+
+    Slot slots[numSlots];
+    Semaphore workAvailable;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // The workers waiting on workAvailable, so that queue only posts when one of them needs waking
+    std::atomic<int> numParked { 0 };
+
+    // Jobs are only queued while at least one worker is running at real time priority
+    std::atomic<int> numRealtimeWorkers { 0 };
+
+    /**
+     @return The job being run on this thread, which is where submitChild finds its parent
+     */
+    static Job*& getCurrentJob()
+    {
+        static thread_local Job* currentJob = nullptr;
+        return currentJob;
+    }
+
+    /**
+     Puts a job in the first free slot, leaving it to be run inline if there is none or no worker is real time.
+     */
+    void queue (Job& job, double deadline, const Job* parent)
+    {
+        job.done.store (false, std::memory_order_relaxed);
+        job.slot = -1;
+        job.deadline = deadline;
+
+        if (numRealtimeWorkers.load (std::memory_order_relaxed) == 0)
+            return;
+
+        for (int i = 0; i < numSlots; i++)
+        {
+            Job* expected = nullptr;
+            if (slots[i].job.compare_exchange_strong (expected, &job, std::memory_order_acq_rel))
+            {
+                // A thread choosing a job may see the slot's last deadline or parent for a moment, which only affects
+                // which job it takes, as whoever claims a job runs it
+                slots[i].deadline.store (deadline, std::memory_order_release);
+                slots[i].parent.store (parent, std::memory_order_release);
+                job.slot = i;
+
+                // Pairs with the fence in park, so either this sees the worker parked or the worker sees the job
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+                if (numParked.load (std::memory_order_relaxed) > 0)
+                    workAvailable.post();
+
+                return;
+            }
+        }
+    }
+
+    /**
+     Waits on a worker until a job is queued, or for at most 100ms.
+     */
+    void park()
+    {
+        numParked.fetch_add (1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+
+        if (! hasWaitingJob())
+            workAvailable.wait (100);
+
+        numParked.fetch_sub (1, std::memory_order_relaxed);
+    }
+
+    /**
+     @return True if any slot holds a job
+     */
+    bool hasWaitingJob() const
+    {
+        for (auto& slot : slots)
+        {
+            if (slot.job.load (std::memory_order_relaxed) != nullptr)
+                return true;
+        }
+
+        return false;
+    }
+
+    /**
+     Runs a claimed job with it set as this thread's current job, so that it can submit children.
+     */
+    static void run (Job& job)
+    {
+        Job*& currentJob = getCurrentJob();
+        Job* outerJob = currentJob;
+        currentJob = &job;
+        job.runJob();
+        currentJob = outerJob;
+
+        job.done.store (true, std::memory_order_release);
+    }
+
+    /**
+     Claims a job's slot, so that only whoever claims it runs the job.
+
+     @return True if the slot still held the job and now it is free
+     */
+    bool takeFromSlot (int slot, Job* job)
+    {
+        return slots[slot].job.compare_exchange_strong (job, nullptr, std::memory_order_acq_rel);
+    }
+
+    /**
+     Runs the waiting job with the earliest deadline.
+
+     @param parent Only take the children of this job, or nullptr to take any job
+     @return False if there was no job waiting
+     */
+    bool runEarliestJob (const Job* parent)
+    {
+        while (true)
+        {
+            // Only the slots are read while choosing, as a job may be taken back and its owner gone at any moment
+            int earliest = -1;
+            double earliestDeadline = std::numeric_limits<double>::max();
+            Job* earliestJob = nullptr;
+
+            for (int i = 0; i < numSlots; i++)
+            {
+                Job* job = slots[i].job.load (std::memory_order_acquire);
+                if (job == nullptr || (parent != nullptr && slots[i].parent.load (std::memory_order_acquire) != parent))
+                    continue;
+
+                double deadline = slots[i].deadline.load (std::memory_order_acquire);
+                if (earliest < 0 || deadline < earliestDeadline)
+                {
+                    earliest = i;
+                    earliestDeadline = deadline;
+                    earliestJob = job;
+                }
+            }
+
+            if (earliest < 0)
+                return false;
+
+            if (takeFromSlot (earliest, earliestJob))
+            {
+                run (*earliestJob);
+                return true;
+            }
+        }
+    }
+};
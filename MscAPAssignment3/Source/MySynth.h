@@ -8,25 +8,52 @@
 
     This implements the synth voice in MySynthVoice. It does not do much itself
     other than chain together the various sub components where most of the work
-    is delegated to. On each iteration in the renderNextBlock the various
-    dependencies are updated and then applied. From the perspective of this class
+    is delegated to. The voice is rendered in chunks, with each sub component
+    processing a whole chunk at a time. From the perspective of this class
     this simply gets the source signal from the 3 elements (osc1, osc2 and noiseGen),
     sums them together and then passes them through the filter and amp modules.
-    An LFO sample is gotten at the start of each iteration and passed to each
-    sub-component along with a boolean of whether it applies to that compenent
-    at the time. How the LFO is applied is left to the other classes.
+    A chunk of LFO samples is rendered first and passed to each sub-component,
+    which is told at compile time whether it applies to that component. How the
+    LFO is applied is left to the other classes.
+
+    The settings that only change between blocks (LFO routing, whether osc2 and
+    the noise are audible, the filter and distortion switches) select one of a
+    table of render kernels once per block. Each kernel is compiled for its
+    combination so stages that are not in use are removed entirely.
+
+    When cross modulation is selected, osc2 is rendered first and osc1 is then
+    rendered from it in a single fused loop instead of the two being summed.
+
+    The voice itself is mono. Each chunk is added to the output channels with
+    a vectorised add scaled by a constant power pan gain that is chosen when the
+    note starts, so stereo spread costs nothing per sample. The pan mode can
+    spread notes by pitch, alternate them left and right or place them randomly.
+
+    MySynthesiser replaces the block splitting done by juce::Synthesiser. Rather
+    than rendering every voice up to each MIDI event in turn, it hands all of
+    the block's events to the voices first. The voices only queue them up with
+    their sample offset and then apply them at that exact offset while rendering
+    the whole block in one go. This means only a voice that actually has an
+    event in the block gets its render split, the rest are rendered in a single
+    pass no matter how dense the MIDI is.
  
   ==============================================================================
 */
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <utility>
 #include "MyAmp.h"
+#include "MyArena.h"
 #include "MyFilter.h"
 #include "MyLfo.h"
 #include "MyNoiseGenerator.h"
 #include "MyOscillator.h"
 #include "MyParameters.h"
+#include "MyScheduler.h"
 
 // ===========================
 // ===========================
@@ -39,6 +66,65 @@ public:
     bool appliesToChannel (int) override { return true; }
 };
 
+// ===========================
+// ===========================
+// SCHEDULE
+/*!
+ @class MyVoiceSchedule
+ @abstract Shared state between MySynthesiser and its voices.
+ @discussion Holds the offset of the MIDI event currently being handled and the dense list of voice indices that
+             have something to render, so that idle voices never need to be visited.
+ */
+class MyVoiceSchedule
+{
+public:
+    /**
+     Must be called before any voices are activated so the lists never need to grow on the audio thread.
+
+     @param numVoices The total number of voices in the synthesiser
+     */
+    void setNumVoices (int numVoices)
+    {
+        activeVoices.reserve (numVoices);
+        isListed.resize (numVoices, false);
+    }
+
+    /**
+     Adds the voice to the active list if it is not already in it.
+
+     @param voiceIndex The index of the voice in the synthesiser
+     */
+    void activate (int voiceIndex)
+    {
+        if (! isListed[voiceIndex])
+        {
+            isListed[voiceIndex] = true;
+            activeVoices.push_back (voiceIndex);
+        }
+    }
+
+    /**
+     Removes the voice at the given position in the active list by swapping the last entry into its place.
+
+     @param position The position in the active list, not the voice index
+     */
+    void deactivateAt (int position)
+    {
+        isListed[activeVoices[position]] = false;
+        activeVoices[position] = activeVoices.back();
+        activeVoices.pop_back();
+    }
+
+    int currentEventOffset = 0;
+    std::vector<int> activeVoices;
+
+    /// Counts notes started across all voices so the alternating pan mode can take turns.
+    int notesStarted = 0;
+
+private:
+    std::vector<bool> isListed;
+};
+
 // =================================
 // =================================
 // Synthesiser Voice - your synth code goes in here
@@ -51,7 +137,7 @@ public:
  @namespace none
  @updated 2019-06-18
  */
-class MySynthVoice : public juce::SynthesiserVoice
+class MySynthVoice final : public juce::SynthesiserVoice
 {
 public:
     /**
@@ -62,8 +148,9 @@ public:
      @param _params A pointer to the user editable parameters.
      */
     MySynthVoice (MyParameters* _params) :
-    osc1 (_params->osc1Type, _params->osc1Gain, _params->osc1Octave, _params->osc1Cents, _params->osc1Push),
-    osc2 (_params->osc2Type, _params->osc2Gain, _params->osc2Octave, _params->osc2Cents, _params->osc2Push),
+    params (_params),
+    osc1 (_params->osc1Type, _params->osc1Gain, _params->osc1Octave, _params->osc1Cents, _params->osc1Push, _params->osc1Unison, _params->osc1Detune, _params->oscAliasThreshold, &_params->quality),
+    osc2 (_params->osc2Type, _params->osc2Gain, _params->osc2Octave, _params->osc2Cents, _params->osc2Push, _params->osc2Unison, _params->osc2Detune, _params->oscAliasThreshold, &_params->quality),
     noiseGen (_params),
     lfo (_params),
     filter (_params),
@@ -85,17 +172,11 @@ public:
      */
     void startNote (int midiNoteNumber, float velocity, juce::SynthesiserSound*, int /*currentPitchWheelPosition*/) override
     {
-        playing = true;
-        ending = false;
-
         float frequency = juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber);
 
-        osc1.startNote (frequency);
-        osc2.startNote (frequency);
-        noiseGen.startNote();
-
-        filter.startNote();
-        amp.startNote (velocity);
+        // Counted here rather than when the note is applied, as the voices may be rendered at the same time
+        int panTurn = schedule != nullptr ? schedule->notesStarted++ : 0;
+        queueEvent ({ PendingEvent::start, getEventOffset(), frequency, velocity, midiNoteNumber, panTurn });
     }
     //--------------------------------------------------------------------------
     /// Called when a MIDI noteOff message is received
@@ -107,18 +188,16 @@ public:
      */
     void stopNote (float /*velocity*/, bool allowTailOff) override
     {
-        noiseGen.stopNote();
-        filter.stopNote();
-        amp.stopNote();
-
         if (allowTailOff)
         {
-            ending = true;
+            queueEvent ({ PendingEvent::stop, getEventOffset(), 0.0f, 0.0f, 0, 0 });
         }
         else
         {
+            // The Synthesiser needs to know straight away that this voice is free
+            // but the sound itself is only cut at the event's offset.
             clearCurrentNote();
-            playing = false;
+            queueEvent ({ PendingEvent::kill, getEventOffset(), 0.0f, 0.0f, 0, 0 });
         }
     }
 
@@ -128,51 +207,120 @@ public:
      
      If the sound that the voice is playing finishes during the course of this rendered block, it must call clearCurrentNote(), to tell the synthesiser that it has finished
 
+     Any note events queued for this block are applied at their offsets, splitting the render of this voice only.
+
      @param outputBuffer pointer to output
      @param startSample position of first sample in buffer
      @param numSamples number of smaples in output buffer
      */
     void renderNextBlock (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
     {
-        if (playing) // check to see if this voice should be playing
+        renderVoice (outputBuffer, startSample, numSamples);
+    }
+
+    /**
+     Non-virtual version of renderNextBlock that MySynthesiser calls directly for its active voices.
+
+     @param outputBuffer pointer to output
+     @param startSample position of first sample in buffer
+     @param numSamples number of smaples in output buffer
+     */
+    void renderVoice (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
+    {
+        int renderedSamples = 0;
+        clearNoteWhenFinished = ! isStartQueuedAfter (-1);
+
+        for (int eventIndex = 0; eventIndex < numPendingEvents; eventIndex++)
         {
-            float sampleRate = getSampleRate();
+            const PendingEvent& event = pendingEvents[eventIndex];
+            int eventOffset = std::min (event.offset, numSamples);
 
-            noiseGen.updateParams (sampleRate);
-            amp.updateParams (sampleRate);
+            render (outputBuffer, startSample + renderedSamples, eventOffset - renderedSamples);
+            renderedSamples = std::max (renderedSamples, eventOffset);
 
-            for (int sampleIndex = startSample; sampleIndex < (startSample + numSamples); sampleIndex++)
-            {
-                // Get the LFO sample for this iteration to pass to the various subsystems.
-                lfo.updateParams (sampleRate);
-                float lfoSample = lfo.getNextSample();
+            applyEvent (event, isStartQueuedAfter (eventIndex));
+        }
 
-                // Ensure the oscillators are up to date with the LFO or user parameters.
-                osc1.updateParams (sampleRate, lfo.appliesToOsc1Frequency(), lfo.appliesToOsc1Cents(), lfoSample);
-                osc2.updateParams (sampleRate, lfo.appliesToOsc2Frequency(), lfo.appliesToOsc2Cents(), lfoSample);
+        numPendingEvents = 0;
+        render (outputBuffer, startSample + renderedSamples, numSamples - renderedSamples);
+    }
 
-                // Create the source signal by summing the oscillators and the noise
-                float sourceSample = osc1.getNextSample() + osc2.getNextSample() + noiseGen.getNextSample();
-                
-                // Apply the filter to the source signal
-                float filteredSample = filter.apply (sampleRate, sourceSample, lfo.appliesToFilterFrequency(), lfo.appliesToFilterQ(), lfoSample);
+    /**
+     Connects the voice to the synthesiser's schedule.
 
-                // Apply the amp envelope, distortion and output volume
-                float ampedSample = amp.apply (filteredSample, lfo.appliesToAmpVolume(), lfo.appliesToAmpDistortion(), lfoSample);
+     @param _schedule The schedule owned by the synthesiser
+     @param _voiceIndex The index of this voice within the synthesiser
+     */
+    void setSchedule (MyVoiceSchedule* _schedule, int _voiceIndex)
+    {
+        schedule = _schedule;
+        voiceIndex = _voiceIndex;
 
-                // for each channel, write the sample to the output
-                for (int chan = 0; chan < outputBuffer.getNumChannels(); chan++)
-                    outputBuffer.addSample (chan, sampleIndex, ampedSample);
+        noiseGen.setSeed (voiceIndex);
+        panRandom.setSeed (uint32_t (voiceIndex) + 0x20000u);
+    }
 
-                // Clear the note once the amp envelope is finished.
-                if (ending && amp.isClosed())
-                {
-                    clearCurrentNote();
-                    playing = false;
-                    ending = false;
-                }
-            }
-        }
+    /**
+     Takes the voice's scratch buffers and those of its modules from the arena. Called from the arena's layout
+     function, so the voice must not be rendered until the arena is prepared.
+
+     @param arena The arena being laid out
+     */
+    void allocate (MyArena& arena)
+    {
+        voiceBuffer = arena.allocate<float> (maxChunkSize);
+        oscBuffer = arena.allocate<float> (maxChunkSize);
+        lfoBuffer = arena.allocate<float> (maxChunkSize);
+
+        noiseGen.allocate (arena);
+        filter.allocate (arena);
+        amp.allocate (arena);
+    }
+
+    /**
+     @param osc1Stream The sample stream for osc1
+     @param osc2Stream The sample stream for osc2
+     */
+    void setSampleStreams (MySampleStream* osc1Stream, MySampleStream* osc2Stream)
+    {
+        osc1.setSampleStream (osc1Stream);
+        osc2.setSampleStream (osc2Stream);
+    }
+
+    /**
+     @param osc1Shape The baked Push Square tables for osc1
+     @param osc2Shape The baked Push Square tables for osc2
+     */
+    void setBakedShapes (MyBakedShape* osc1Shape, MyBakedShape* osc2Shape)
+    {
+        osc1.setBakedShape (osc1Shape);
+        osc2.setBakedShape (osc2Shape);
+    }
+
+    /**
+     @return How loud the voice's release tail is, or -1 if the voice is not releasing
+     */
+    float getReleaseLevel() const
+    {
+        return (playing && ending && cullSamplesLeft < 0) ? amp.getLevel() : -1.0f;
+    }
+
+    /**
+     Fades the voice out over cullFadeTime and then stops it. Only used for quiet release tails when the CPU governor
+     caps polyphony, and only between blocks, so there are no pending note events to worry about.
+     */
+    void cull()
+    {
+        cullFadeLength = std::max (1, int (getSampleRate() * cullFadeTime));
+        cullSamplesLeft = cullFadeLength;
+    }
+
+    /**
+     @return True if the voice is playing or has note events waiting, false if it can be left out of rendering
+     */
+    bool needsRendering() const
+    {
+        return playing || numPendingEvents > 0;
     }
 
     //--------------------------------------------------------------------------
@@ -192,12 +340,45 @@ public:
     }
     //--------------------------------------------------------------------------
 private:
+    /**
+     A note event waiting to be applied at its offset within the next rendered block.
+     */
+    struct PendingEvent
+    {
+        enum Type { start, stop, kill };
+
+        Type type;
+        int offset;
+        float frequency;
+        float velocity;
+        int noteNumber;
+        // How many notes the synthesiser had started before this one, for the alternating pan mode
+        int panTurn;
+    };
+
     //--------------------------------------------------------------------------
     // Set up any necessary variables here
     /// Should the voice be playing?
     bool playing = false;
     bool ending = false;
 
+    // How long a culled tail takes to fade out, in seconds, short enough to free the voice quickly without a click
+    static constexpr double cullFadeTime = 0.005;
+    int cullFadeLength = 1;
+    // The samples left of a cull's fade, or -1 if the voice is not being culled
+    int cullSamplesLeft = -1;
+
+    // More than a handful of events for one voice in one block is very unlikely,
+    // so if this fills up two neighbouring events are merged, see mergePendingEvents.
+    static constexpr int maxPendingEvents = 16;
+    PendingEvent pendingEvents[maxPendingEvents];
+    int numPendingEvents = 0;
+
+    MyVoiceSchedule* schedule = nullptr;
+    int voiceIndex = 0;
+
+    MyParameters* params;
+
     MyOscillator osc1;
     MyOscillator osc2;
     MyNoiseGenerator noiseGen;
@@ -205,4 +386,630 @@ private:
 
     MyFilter filter;
     MyAmp amp;
+
+    // Scratch buffers for the render kernels, in the processor's arena
+    static constexpr int maxChunkSize = MyEnvelope::maxBlockSize;
+    float* voiceBuffer = nullptr;
+    float* oscBuffer = nullptr;
+    float* lfoBuffer = nullptr;
+
+    int getEventOffset() const
+    {
+        return schedule != nullptr ? schedule->currentEventOffset : 0;
+    }
+
+    void queueEvent (const PendingEvent& event)
+    {
+        if (schedule != nullptr)
+            schedule->activate (voiceIndex);
+
+        if (numPendingEvents == maxPendingEvents)
+        {
+            // A voice should never get this many events in one block, so make it visible in debug builds
+            jassertfalse;
+            mergePendingEvents();
+        }
+
+        pendingEvents[numPendingEvents++] = event;
+    }
+
+    /**
+     Makes room in a full queue by merging the first two neighbouring events that can be merged. Any two neighbours
+     can be apart from a stop followed by a start, and those can never fill the queue on their own, so this always
+     frees at least one place.
+
+     * A start followed by a stop or kill is a note that begins and ends inside the block, so both are dropped.
+     * A start followed by another start: the first note never sounds, so the first is dropped.
+     * A stop or kill followed by another: the second does nothing unless it is a kill after a stop, so the one
+       that matters is kept.
+     */
+    void mergePendingEvents()
+    {
+        for (int i = 0; i + 1 < numPendingEvents; i++)
+        {
+            const PendingEvent& first = pendingEvents[i];
+            const PendingEvent& second = pendingEvents[i + 1];
+
+            int numRemoved;
+            if (first.type == PendingEvent::start)
+            {
+                numRemoved = second.type == PendingEvent::start ? 1 : 2;
+            }
+            else if (second.type != PendingEvent::start)
+            {
+                // Only a kill after a stop still changes anything, so that one is kept
+                if (! (first.type == PendingEvent::stop && second.type == PendingEvent::kill))
+                    i++;
+
+                numRemoved = 1;
+            }
+            else
+            {
+                continue;
+            }
+
+            std::copy (pendingEvents + i + numRemoved, pendingEvents + numPendingEvents, pendingEvents + i);
+            numPendingEvents -= numRemoved;
+            return;
+        }
+    }
+
+    /**
+     Applies a queued note event to the sub components.
+
+     @param event The event to apply
+     @param startQueuedLater True if another note starts on this voice later in the block, in which case the Synthesiser's note must not be cleared when this tail ends
+     */
+    void applyEvent (const PendingEvent& event, bool startQueuedLater)
+    {
+        switch (event.type)
+        {
+            case PendingEvent::start:
+                playing = true;
+                ending = false;
+                cullSamplesLeft = -1;
+
+                osc1.startNote (event.frequency);
+                osc2.startNote (event.frequency);
+                noiseGen.startNote();
+
+                filter.startNote();
+                amp.startNote (event.velocity);
+
+                updatePan (event.noteNumber, event.panTurn);
+                break;
+
+            case PendingEvent::stop:
+                noiseGen.stopNote();
+                filter.stopNote();
+                amp.stopNote();
+                ending = true;
+                break;
+
+            case PendingEvent::kill:
+                noiseGen.stopNote();
+                filter.stopNote();
+                amp.stopNote();
+                playing = false;
+                ending = false;
+                cullSamplesLeft = -1;
+                break;
+        }
+
+        clearNoteWhenFinished = ! startQueuedLater;
+    }
+
+    bool isStartQueuedAfter (int eventIndex) const
+    {
+        for (int i = eventIndex + 1; i < numPendingEvents; i++)
+            if (pendingEvents[i].type == PendingEvent::start)
+                return true;
+
+        return false;
+    }
+
+    /**
+     Renders a contiguous run of samples with no note events inside it.
+
+     The render kernel is picked once here from the current settings and then run over chunks of up to maxChunkSize samples.
+
+     @param outputBuffer pointer to output
+     @param startSample position of first sample in buffer
+     @param numSamples number of smaples to render
+     */
+    void render (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
+    {
+        if (playing && numSamples > 0) // check to see if this voice should be playing
+        {
+            float sampleRate = getSampleRate();
+
+            noiseGen.updateParams (sampleRate);
+            amp.updateParams (sampleRate);
+            lfo.updateParams (sampleRate);
+
+            crossMod = MyOscillator::CrossMod (params->oscModMode->getIndex());
+
+            Kernel kernel = getKernel (getKernelIndex (lfo.getTarget(),
+                                                       ! osc2.isSilent(),
+                                                       ! noiseGen.isSilent(),
+                                                       params->filterOn->get(),
+                                                       params->ampDistOn->get()));
+
+            int endSample = startSample + numSamples;
+            int chunkSize;
+            for (int chunkStart = startSample; chunkStart < endSample; chunkStart += chunkSize)
+            {
+                // Chunks end where the amp envelope changes stage, so each one is a single segment of it and a
+                // release ends on the last sample of a chunk
+                chunkSize = std::min ({ maxChunkSize, endSample - chunkStart, amp.getSamplesUntilNextStage() });
+                (this->*kernel) (chunkSize, sampleRate);
+
+                if (cullSamplesLeft >= 0)
+                    applyCullFade (chunkSize);
+
+                // Mix the mono voice into the output, panned if there are two channels
+                int numChannels = outputBuffer.getNumChannels();
+                if (numChannels == 2)
+                {
+                    outputBuffer.addFrom (0, chunkStart, voiceBuffer, chunkSize, leftGain);
+                    outputBuffer.addFrom (1, chunkStart, voiceBuffer, chunkSize, rightGain);
+                }
+                else
+                {
+                    for (int chan = 0; chan < numChannels; chan++)
+                        outputBuffer.addFrom (chan, chunkStart, voiceBuffer, chunkSize);
+                }
+
+                // Clear the note once the amp envelope or a cull's fade is finished. If another
+                // note has been queued on this voice later in the block then the
+                // Synthesiser already thinks of it as playing that note instead.
+                if ((ending && amp.isClosed()) || cullSamplesLeft == 0)
+                {
+                    if (clearNoteWhenFinished)
+                        clearCurrentNote();
+                    playing = false;
+                    ending = false;
+                    cullSamplesLeft = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     Ramps voiceBuffer down along the rest of a cull's fade, leaving silence once it is over.
+
+     @param numSamples The number of samples in voiceBuffer
+     */
+    void applyCullFade (int numSamples)
+    {
+        float step = 1.0f / float (cullFadeLength);
+
+        for (int i = 0; i < numSamples; i++)
+            voiceBuffer[i] *= float (std::max (0, cullSamplesLeft - i)) * step;
+
+        cullSamplesLeft = std::max (0, cullSamplesLeft - numSamples);
+    }
+
+    //--------------------------------------------------------------------------
+    // Render kernels
+    //
+    // Each kernel is the whole voice signal chain for one combination of the
+    // settings that only change between blocks. The combination is encoded in
+    // the kernel index so that every kernel can be put in a table and looked
+    // up once per block. Stages that are not in use are removed at compile time.
+
+    using Kernel = void (MySynthVoice::*) (int, float);
+
+    static constexpr int numKernels = MyLfo::numTargets * 16;
+
+    static int getKernelIndex (int lfoTarget, bool osc2On, bool noiseOn, bool filterOn, bool distOn)
+    {
+        return (lfoTarget * 16) + (osc2On ? 8 : 0) + (noiseOn ? 4 : 0) + (filterOn ? 2 : 0) + (distOn ? 1 : 0);
+    }
+
+    template <int... kernelIndices>
+    static constexpr std::array<Kernel, sizeof... (kernelIndices)> makeKernelTable (std::integer_sequence<int, kernelIndices...>)
+    {
+        return { { &MySynthVoice::renderKernel<kernelIndices>... } };
+    }
+
+    static Kernel getKernel (int kernelIndex)
+    {
+        static constexpr auto kernels = makeKernelTable (std::make_integer_sequence<int, numKernels>());
+        return kernels[kernelIndex];
+    }
+
+    /**
+     Renders one chunk of the voice into voiceBuffer.
+
+     @param numSamples The number of samples to render, no more than maxChunkSize
+     @param sampleRate The current sample rate
+     */
+    template <int kernelIndex>
+    void renderKernel (int numSamples, float sampleRate)
+    {
+        constexpr int lfoTarget = kernelIndex / 16;
+        constexpr bool osc2On = (kernelIndex & 8) != 0;
+        constexpr bool noiseOn = (kernelIndex & 4) != 0;
+        constexpr bool filterOn = (kernelIndex & 2) != 0;
+        constexpr bool distOn = (kernelIndex & 1) != 0;
+
+        // Get the LFO samples for this chunk to pass to the various subsystems.
+        if constexpr (lfoTarget != MyLfo::noTarget)
+            lfo.renderBlock (lfoBuffer, numSamples);
+
+        // Create the source signal by summing (or cross modulating) the oscillators and adding the noise
+        if (crossMod == MyOscillator::CrossMod::none)
+        {
+            osc1.renderBlock<MyLfo::appliesToOsc1Frequency (lfoTarget), MyLfo::appliesToOsc1Cents (lfoTarget)> (voiceBuffer, numSamples, sampleRate, lfoBuffer);
+
+            if constexpr (osc2On)
+            {
+                osc2.renderBlock<MyLfo::appliesToOsc2Frequency (lfoTarget), MyLfo::appliesToOsc2Cents (lfoTarget)> (oscBuffer, numSamples, sampleRate, lfoBuffer);
+                juce::FloatVectorOperations::add (voiceBuffer, oscBuffer, numSamples);
+            }
+        }
+        else
+        {
+            renderCrossModulation<lfoTarget> (numSamples, sampleRate);
+        }
+
+        if constexpr (noiseOn)
+            noiseGen.addBlock (voiceBuffer, numSamples);
+
+        // Apply the filter to the source signal
+        if constexpr (filterOn)
+            filter.renderBlock<MyLfo::appliesToFilterFrequency (lfoTarget), MyLfo::appliesToFilterQ (lfoTarget)> (voiceBuffer, numSamples, sampleRate, lfoBuffer);
+
+        // Apply the amp envelope, distortion and output volume
+        amp.renderBlock<distOn, MyLfo::appliesToAmpVolume (lfoTarget), MyLfo::appliesToAmpDistortion (lfoTarget)> (voiceBuffer, numSamples, lfoBuffer);
+    }
+
+    /**
+     Renders osc1 cross modulated by osc2 into voiceBuffer. osc2 is only the modulator or sync master here, so it is
+     rendered without its gain and is not heard on its own.
+     */
+    template <int lfoTarget>
+    void renderCrossModulation (int numSamples, float sampleRate)
+    {
+        constexpr bool osc1Freq = MyLfo::appliesToOsc1Frequency (lfoTarget);
+        constexpr bool osc1Cents = MyLfo::appliesToOsc1Cents (lfoTarget);
+        constexpr bool osc2Freq = MyLfo::appliesToOsc2Frequency (lfoTarget);
+        constexpr bool osc2Cents = MyLfo::appliesToOsc2Cents (lfoTarget);
+
+        float depth = *params->oscModDepth;
+
+        switch (crossMod)
+        {
+            case MyOscillator::CrossMod::frequency:
+                osc2.renderModulator<osc2Freq, osc2Cents> (oscBuffer, numSamples, sampleRate, lfoBuffer);
+                osc1.renderModulated<MyOscillator::CrossMod::frequency, osc1Freq, osc1Cents> (voiceBuffer, numSamples, sampleRate, lfoBuffer, oscBuffer, depth);
+                break;
+            case MyOscillator::CrossMod::phase:
+                osc2.renderModulator<osc2Freq, osc2Cents> (oscBuffer, numSamples, sampleRate, lfoBuffer);
+                osc1.renderModulated<MyOscillator::CrossMod::phase, osc1Freq, osc1Cents> (voiceBuffer, numSamples, sampleRate, lfoBuffer, oscBuffer, depth);
+                break;
+            case MyOscillator::CrossMod::ring:
+                osc2.renderModulator<osc2Freq, osc2Cents> (oscBuffer, numSamples, sampleRate, lfoBuffer);
+                osc1.renderRing<osc1Freq, osc1Cents> (voiceBuffer, numSamples, sampleRate, lfoBuffer, oscBuffer, depth);
+                break;
+            case MyOscillator::CrossMod::sync:
+                osc2.renderSyncPositions<osc2Freq, osc2Cents> (oscBuffer, numSamples, sampleRate, lfoBuffer);
+                osc1.renderSynced<osc1Freq, osc1Cents> (voiceBuffer, numSamples, sampleRate, lfoBuffer, oscBuffer);
+                break;
+            default:
+                break;
+        }
+    }
+
+    bool clearNoteWhenFinished = true;
+    MyOscillator::CrossMod crossMod = MyOscillator::CrossMod::none;
+
+    // Constant power pan gains for this note, normalised so the centre is at full level in both channels.
+    float leftGain = 1.0f;
+    float rightGain = 1.0f;
+    MyCounterRandom panRandom;
+
+    /**
+     Works out the pan position for a new note from the pan mode and spread, and the gains for that position.
+
+     @param noteNumber The MIDI note being started
+     @param panTurn How many notes were started before this one
+     */
+    void updatePan (int noteNumber, int panTurn)
+    {
+        float pan; // -1 is hard left, 1 is hard right
+
+        switch (params->voicePanMode->getIndex())
+        {
+            case 1:
+                // Spread the keyboard out with the pan centred on middle C and fully out four octaves either side.
+                pan = juce::jlimit (-1.0f, 1.0f, (noteNumber - 60) / 48.0f);
+                break;
+            case 2:
+                pan = (panTurn % 2) != 0 ? 1.0f : -1.0f;
+                break;
+            case 3:
+                panRandom.fillBipolar (&pan, 1);
+                break;
+            default:
+                pan = 0.0f;
+        }
+
+        pan *= *params->voicePanSpread;
+
+        float angle = (pan + 1.0f) * juce::MathConstants<float>::pi * 0.25f;
+        leftGain = juce::MathConstants<float>::sqrt2 * std::cos (angle);
+        rightGain = juce::MathConstants<float>::sqrt2 * std::sin (angle);
+    }
+};
+
+// ===========================
+// ===========================
+// SYNTHESISER
+/*!
+ @class MySynthesiser
+ @abstract Synthesiser that renders each voice once per block regardless of how many MIDI events arrive.
+ @discussion juce::Synthesiser splits the block at every MIDI event and renders all voices for every fragment.
+             This instead handles all of the block's MIDI up front, with the voices queueing the note events
+             at their offsets, and then renders every voice across the full block.
+
+             Only the voices in the schedule's active list are rendered and they are called through their
+             concrete type rather than the virtual SynthesiserVoice interface. Voices drop out of the list
+             once they have finished.
+
+             It also owns the disk thread that streams the sample for the Sample oscillator type, with one
+             stream for each oscillator of each voice, and the thread that bakes the Push Square wavetables.
+
+             When the block is rendered inside a scheduler job, such as the pipeline's, each voice is handed
+             out as a child job with its own buffer, see setScheduler.
+ */
+class MySynthesiser : public juce::Synthesiser
+{
+public:
+    /**
+     @param params The parameters, used to start baking the Push Square tables for each oscillator
+     */
+    MySynthesiser (MyParameters* _params) : params (_params)
+    {
+        osc1PushSquare = wavetableBaker.addShape (params->osc1Push, MyOscillator::getPushSquareSample);
+        osc2PushSquare = wavetableBaker.addShape (params->osc2Push, MyOscillator::getPushSquareSample);
+        wavetableBaker.start();
+    }
+
+    /**
+     Adds a voice and lets it know where to find the offset of the event being handled.
+
+     @param voice The voice to add, ownership is taken by the synthesiser
+     */
+    MySynthVoice* addVoice (MySynthVoice* voice)
+    {
+        voice->setSchedule (&schedule, (int) myVoices.size());
+        voice->setSampleStreams (sampleStreamer.addStream(), sampleStreamer.addStream());
+        voice->setBakedShapes (osc1PushSquare, osc2PushSquare);
+        myVoices.push_back (voice);
+        schedule.setNumVoices ((int) myVoices.size());
+        juce::Synthesiser::addVoice (voice);
+        return voice;
+    }
+
+    /**
+     Takes every voice's buffers from the arena, one voice after another. Called from the arena's layout function.
+
+     @param arena The arena being laid out
+     */
+    void allocate (MyArena& arena)
+    {
+        for (auto* voice : myVoices)
+            voice->allocate (arena);
+    }
+
+    /**
+     Renders the voices as child jobs of the job rendering the block, so that free workers and the thread waiting
+     for that job share them out. Each voice renders into its own buffer and they are added to the output in order,
+     so the result is the same as rendering them one after another. Not real time safe.
+
+     @param _scheduler The scheduler the block is rendered on, or nullptr to render the voices one after another
+     @param maxSamples The most samples renderNextBlock will be asked for
+     @param numChannels The number of channels renderNextBlock will be given
+     */
+    void setScheduler (MyScheduler* _scheduler, int maxSamples, int numChannels)
+    {
+        scheduler = _scheduler;
+        voiceJobs.clear();
+
+        if (scheduler == nullptr)
+            return;
+
+        for (auto* voice : myVoices)
+        {
+            voiceJobs.push_back (std::make_unique<VoiceJob>());
+            voiceJobs.back()->voice = voice;
+            voiceJobs.back()->buffer.setSize (numChannels, maxSamples);
+        }
+    }
+
+    /**
+     Swaps in the sample played by the Sample oscillator type, from the start of a later block. Never call this on the
+     audio thread.
+
+     @param sample The new sample, or nullptr for none
+     */
+    void setSample (std::shared_ptr<MySample> sample)
+    {
+        sampleStreamer.setSample (std::move (sample));
+    }
+
+    /**
+     Replaces juce::Synthesiser::renderNextBlock so that the block is never split at MIDI events.
+
+     @param outputAudio The buffer to add the voices to
+     @param inputMidi The MIDI events for this block
+     @param startSample position of first sample in buffer
+     @param numSamples number of samples to render
+     */
+    void renderNextBlock (juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& inputMidi, int startSample, int numSamples)
+    {
+        const juce::ScopedLock sl (lock);
+        sampleStreamer.beginBlock();
+
+        for (const auto metadata : inputMidi)
+        {
+            if (metadata.samplePosition < startSample)
+                continue;
+
+            // Anything beyond the end of the block is applied once the block is rendered, as juce::Synthesiser does.
+            schedule.currentEventOffset = std::min (metadata.samplePosition - startSample, numSamples);
+            handleMidiEvent (metadata.getMessage());
+        }
+
+        schedule.currentEventOffset = 0;
+        wavetableBaker.beginBlock();
+
+        auto& activeVoices = schedule.activeVoices;
+        int numActiveVoices = (int) activeVoices.size();
+
+        if (canRenderVoiceJobs (outputAudio, numSamples) && numActiveVoices > 1)
+        {
+            renderVoiceJobs (outputAudio, startSample, numSamples);
+        }
+        else
+        {
+            for (int i = 0; i < numActiveVoices; i++)
+            {
+                if (i + 1 < numActiveVoices)
+                    prefetch (myVoices[activeVoices[i + 1]]);
+
+                myVoices[activeVoices[i]]->renderVoice (outputAudio, startSample, numSamples);
+            }
+        }
+
+        wavetableBaker.endBlock (numSamples);
+        cullReleaseTails (params->quality.getSettings().maxReleasingVoices);
+
+        // Iterating backwards so that swapping the last entry in does not skip anything.
+        for (int i = numActiveVoices - 1; i >= 0; i--)
+        {
+            if (! myVoices[activeVoices[i]]->needsRendering())
+                schedule.deactivateAt (i);
+        }
+    }
+
+private:
+    MyParameters* params;
+    MyVoiceSchedule schedule;
+    MySampleStreamer sampleStreamer;
+
+    MyWavetableBaker wavetableBaker;
+    MyBakedShape* osc1PushSquare;
+    MyBakedShape* osc2PushSquare;
+
+    // The same voices as held by juce::Synthesiser but with their concrete type.
+    std::vector<MySynthVoice*> myVoices;
+
+    /**
+     Renders one voice into its own buffer, on a worker or on the thread that finishes it.
+     */
+    class VoiceJob : public MyScheduler::Job
+    {
+    public:
+        MySynthVoice* voice = nullptr;
+        juce::AudioBuffer<float> buffer;
+        int numSamples = 0;
+
+        void runJob() override
+        {
+            buffer.clear (0, numSamples);
+            voice->renderVoice (buffer, 0, numSamples);
+        }
+    };
+
+    // One job for each voice, indexed like myVoices, while there is a scheduler
+    MyScheduler* scheduler = nullptr;
+    std::vector<std::unique_ptr<VoiceJob>> voiceJobs;
+
+    /**
+     @return True if the voice jobs can render this block, which needs their buffers to match the output
+     */
+    bool canRenderVoiceJobs (const juce::AudioBuffer<float>& outputAudio, int numSamples) const
+    {
+        return scheduler != nullptr
+            && outputAudio.getNumChannels() == voiceJobs.front()->buffer.getNumChannels()
+            && numSamples <= voiceJobs.front()->buffer.getNumSamples();
+    }
+
+    /**
+     Submits every active voice as a child job and then adds each one to the output as it is finished.
+
+     @param outputAudio The buffer to add the voices to
+     @param startSample position of first sample in buffer
+     @param numSamples number of samples to render
+     */
+    void renderVoiceJobs (juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples)
+    {
+        const auto& activeVoices = schedule.activeVoices;
+
+        for (int index : activeVoices)
+        {
+            VoiceJob& job = *voiceJobs[(size_t) index];
+            job.numSamples = numSamples;
+            scheduler->submitChild (job);
+        }
+
+        for (int index : activeVoices)
+        {
+            VoiceJob& job = *voiceJobs[(size_t) index];
+            scheduler->finish (job);
+
+            for (int channel = 0; channel < outputAudio.getNumChannels(); channel++)
+                outputAudio.addFrom (channel, startSample, job.buffer, channel, 0, numSamples);
+        }
+    }
+
+    /**
+     Fades out the quietest release tails until no more than maxReleasing voices are releasing.
+
+     @param maxReleasing The most voices allowed to be releasing
+     */
+    void cullReleaseTails (int maxReleasing)
+    {
+        const auto& activeVoices = schedule.activeVoices;
+        int numReleasing = 0;
+
+        for (int index : activeVoices)
+            if (myVoices[index]->getReleaseLevel() >= 0.0f)
+                numReleasing++;
+
+        while (numReleasing > maxReleasing)
+        {
+            MySynthVoice* quietest = nullptr;
+
+            for (int index : activeVoices)
+            {
+                float level = myVoices[index]->getReleaseLevel();
+                if (level >= 0.0f && (quietest == nullptr || level < quietest->getReleaseLevel()))
+                    quietest = myVoices[index];
+            }
+
+            quietest->cull();
+            numReleasing--;
+        }
+    }
+
+    /**
+     Hints to the CPU to start loading the voice's state into cache while the current voice renders.
+
+     @param voice The voice that will be rendered next
+     */
+    static void prefetch (const MySynthVoice* voice)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        const char* bytes = reinterpret_cast<const char*> (voice);
+        for (size_t offset = 0; offset < sizeof (MySynthVoice); offset += 64)
+            __builtin_prefetch (bytes + offset);
+#else
+        juce::ignoreUnused (voice);
+#endif
+    }
 };
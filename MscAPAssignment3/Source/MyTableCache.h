@@ -0,0 +1,168 @@
+/*
+  ==============================================================================
+
+    MyTableCache.h
+
+    This shares read-only DSP tables, such as the baked wavetables
+    (MyWavetable.h), between every instance of the plugin in the host
+    process. With many instances open most of them are playing the same
+    tables, so each one only needs to be built and held in memory once.
+
+    A table is looked up by its type, the sample rate it was built for (0 for
+    tables that do not depend on it) and a hash of everything it was built
+    from. The first thread to ask for a table builds it, and any other thread
+    asking for the same one while it is being built waits for it rather than
+    building another copy.
+
+    The tables are handed out as std::shared_ptr and the cache only keeps a
+    weak reference to each, so a table is freed as soon as the last instance
+    stops using it. The cache itself is held with juce::SharedResourcePointer,
+    so there is one for the process for as long as any instance is open.
+
+    Looking a table up can take a lock and build the table, and letting go
+    of one can free it, so neither may be done on the audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <typeindex>
+#include <JuceHeader.h>
+
+class MyTableCache
+{
+public:
+    struct Key
+    {
+        /// The sample rate the table was built for, or 0 if it works at any rate
+        double sampleRate;
+        /// A hash of everything the table is built from, see hash
+        juce::uint64 contentHash;
+
+        bool operator< (const Key& other) const
+        {
+            return std::tie (sampleRate, contentHash) < std::tie (other.sampleRate, other.contentHash);
+        }
+    };
+
+    /**
+     Hashes the values a table is built from into a key's content hash, with 64 bit FNV-1a.
+
+     @param values The values, each of which is hashed as its bits
+     */
+    static juce::uint64 hash (std::initializer_list<juce::uint64> values)
+    {
+        juce::uint64 result = 14695981039346656037ull;
+        for (juce::uint64 value : values)
+        {
+            for (int byte = 0; byte < 8; byte++)
+            {
+                result ^= (value >> (byte * 8)) & 0xff;
+                result *= 1099511628211ull;
+            }
+        }
+        return result;
+    }
+
+    /**
+     @return The bits of a float, so that it can be hashed
+     */
+    static juce::uint64 bitsOf (float value)
+    {
+        juce::uint32 bits;
+        std::memcpy (&bits, &value, sizeof (bits));
+        return bits;
+    }
+
+    /**
+     Finds a table, building it if no instance is using one with the same key. Never call this on the audio thread.
+
+     @param key The table's sample rate and content hash
+     @param build Called with a new default constructed table to fill if it is not already in the cache
+     @return The table, shared with any other instance that asked for the same key
+     */
+    template <typename TableType, typename BuildFunction>
+    std::shared_ptr<const TableType> get (const Key& key, BuildFunction&& build)
+    {
+        EntryKey entryKey { std::type_index (typeid (TableType)), key };
+        std::unique_lock<std::mutex> lock (mutex);
+
+        while (true)
+        {
+            Entry& entry = entries[entryKey];
+            if (auto table = entry.table.lock())
+                return std::static_pointer_cast<const TableType> (table);
+
+            if (! entry.building)
+            {
+                entry.building = true;
+                break;
+            }
+
+            built.wait (lock);
+        }
+
+        // Built without the lock held so that other tables can be looked up meanwhile
+        lock.unlock();
+        auto table = std::make_shared<TableType>();
+        build (*table);
+        lock.lock();
+
+        removeUnused();
+
+        Entry& entry = entries[entryKey];
+        entry.table = table;
+        entry.building = false;
+        built.notify_all();
+
+        return table;
+    }
+
+private:
+    struct EntryKey
+    {
+        std::type_index type;
+        Key key;
+
+        bool operator< (const EntryKey& other) const
+        {
+            if (type != other.type)
+                return type < other.type;
+
+            return key < other.key;
+        }
+    };
+
+    struct Entry
+    {
+        std::weak_ptr<const void> table;
+        bool building = false;
+    };
+
+    std::mutex mutex;
+    std::condition_variable built;
+    std::map<EntryKey, Entry> entries;
+
+    /**
+     Forgets the tables no instance is using any more, so that keys for old parameter values do not pile up. Called
+     with the lock held.
+     */
+    void removeUnused()
+    {
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            if (! it->second.building && it->second.table.expired())
+                it = entries.erase (it);
+            else
+                ++it;
+        }
+    }
+};
@@ -0,0 +1,374 @@
+/*
+  ==============================================================================
+
+    MyWavetable.h
+
+    This implements band-limited wavetables for oscillator shapes that are
+    expensive to calculate but only change when a parameter does, such as
+    Push Square's tanh of a sine.
+
+    * MyWavetable: One cycle of a shape stored as a mipmap of 11 levels. Each
+      level has half the harmonics of the one before, and the level is picked
+      from the phase delta so that no harmonic goes above Nyquist.
+    * MyBakedShape: A shape function and the parameter it depends on. It
+      holds two tables, the one being played and a spare that the next bake
+      is put in. The finished table is published with one atomic store of its
+      slot and version.
+    * MyWavetableBaker: Re-bakes an instance's shapes when their parameters
+      change. The baking is done on one background thread shared by every
+      instance in the process.
+
+    Baked tables are shared with every other instance in the process through
+    the table cache (MyTableCache.h), keyed by the shape and its parameter's
+    value, so instances with the same settings play the same tables and a
+    table is only baked once.
+
+    The oscillators crossfade from the old table to the new one over
+    fadeLength samples. The audio thread marks a version as settled once that
+    many samples have been rendered with it, and only then will the baker
+    replace the old table, so a table is never let go of while it can still
+    be read. The old table and whether it is still safe to fade from are
+    both taken from what the audio thread saw at the start of the block.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "MyTableCache.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <JuceHeader.h>
+
+class MyWavetable
+{
+public:
+    static constexpr int tableSize = 2048;
+    static constexpr int numLevels = 11;
+
+    /**
+     Fills every level from a shape. The shape is analysed into its harmonics with a DFT of an oversampled cycle and
+     then each level is built back up from the harmonics it is allowed. This is slow so it is only done on the baker
+     thread.
+
+     @param shape Returns the shape's value for a phase from 0 to 1
+     */
+    template <typename ShapeFunction>
+    void bake (ShapeFunction shape)
+    {
+        constexpr int analysisSize = tableSize * 4;
+        constexpr int maxHarmonic = tableSize / 2;
+
+        std::vector<double> cycle (analysisSize);
+        std::vector<double> sineTable (analysisSize);
+        for (int n = 0; n < analysisSize; n++)
+        {
+            cycle[(size_t) n] = shape (float (n) / float (analysisSize));
+            sineTable[(size_t) n] = std::sin (juce::MathConstants<double>::twoPi * n / analysisSize);
+        }
+
+        // The cosine is the sine a quarter of a cycle on
+        auto sine = [&sineTable] (long long index) { return sineTable[(size_t) (index % analysisSize)]; };
+        auto cosine = [&sineTable] (long long index) { return sineTable[(size_t) ((index + (analysisSize / 4)) % analysisSize)]; };
+
+        double dc = 0.0;
+        for (double value : cycle)
+            dc += value;
+        dc /= analysisSize;
+
+        std::vector<double> cosineAmounts (maxHarmonic + 1);
+        std::vector<double> sineAmounts (maxHarmonic + 1);
+        for (int k = 1; k <= maxHarmonic; k++)
+        {
+            double a = 0.0;
+            double b = 0.0;
+            for (int n = 0; n < analysisSize; n++)
+            {
+                a += cycle[(size_t) n] * cosine ((long long) k * n);
+                b += cycle[(size_t) n] * sine ((long long) k * n);
+            }
+            cosineAmounts[(size_t) k] = 2.0 * a / analysisSize;
+            sineAmounts[(size_t) k] = 2.0 * b / analysisSize;
+        }
+
+        constexpr int step = analysisSize / tableSize;
+        for (int level = 0; level < numLevels; level++)
+        {
+            int numHarmonics = maxHarmonic >> level;
+
+            for (int n = 0; n < tableSize; n++)
+            {
+                double value = dc;
+                for (int k = 1; k <= numHarmonics; k++)
+                    value += (cosineAmounts[(size_t) k] * cosine ((long long) k * n * step))
+                             + (sineAmounts[(size_t) k] * sine ((long long) k * n * step));
+                levels[level][n] = float (value);
+            }
+
+            // A guard point so the interpolation never has to wrap
+            levels[level][tableSize] = levels[level][0];
+        }
+    }
+
+    /**
+     @param phase The oscillator phase from 0 to 1
+     @param phaseDelta How far the phase moves each sample, which decides the level
+     @return The interpolated value from the level with as many harmonics as fit below Nyquist
+     */
+    float getSample (float phase, float phaseDelta) const
+    {
+        const float* level = levels[getLevel (phaseDelta)];
+
+        float position = phase * float (tableSize);
+        int index = std::min (int (position), tableSize - 1);
+        float fraction = position - float (index);
+
+        return level[index] + (fraction * (level[index + 1] - level[index]));
+    }
+
+private:
+    float levels[numLevels][tableSize + 1];
+
+    /**
+     Level l holds (tableSize / 2) >> l harmonics and harmonic k aliases once k * phaseDelta goes over 0.5, so the level
+     needed is the log2 of phaseDelta * tableSize, rounded up.
+     */
+    static int getLevel (float phaseDelta)
+    {
+        int exponent;
+        std::frexp (std::fabs (phaseDelta) * float (tableSize), &exponent);
+        return juce::jlimit (0, numLevels - 1, exponent);
+    }
+};
+
+//==============================================================================
+class MyBakedShape
+{
+public:
+    /// How many samples the oscillators take to crossfade to a new table
+    static constexpr int fadeLength = 512;
+
+    using ShapeFunction = float (*) (float phase, float parameter);
+
+    /**
+     @param _parameter The parameter the shape depends on
+     @param _shape The shape to bake, given the phase and the parameter's value
+     @param _tableCache The process wide cache the tables are shared through
+     */
+    MyBakedShape (std::atomic<float>* _parameter, ShapeFunction _shape, MyTableCache* _tableCache)
+        : parameter (_parameter), shape (_shape), tableCache (_tableCache)
+    {
+    }
+
+    /**
+     Picks up the latest table for this block. Called by the synthesiser on the audio thread before rendering any
+     voices so that they all see the same table.
+     */
+    void beginBlock()
+    {
+        juce::uint32 published = publishedState.load (std::memory_order_acquire);
+        juce::uint32 version = published >> 1;
+
+        if (version != blockVersion)
+        {
+            previousTable = version == blockVersion + 1 ? blockTable : nullptr;
+            blockVersion = version;
+            blockTable = slots[published & 1].get();
+            samplesSinceChange = 0;
+        }
+    }
+
+    /**
+     Called by the synthesiser on the audio thread after rendering the voices.
+
+     @param numSamples The number of samples just rendered
+     */
+    void endBlock (int numSamples)
+    {
+        if (samplesSinceChange < fadeLength)
+        {
+            samplesSinceChange += numSamples;
+            if (samplesSinceChange >= fadeLength)
+                settledVersion.store (blockVersion, std::memory_order_release);
+        }
+    }
+
+    /**
+     @return The table for this block, or nullptr if none has been baked yet
+     */
+    const MyWavetable* getTable() const
+    {
+        return blockTable;
+    }
+
+    /**
+     @return The version of the table for this block, 0 if none has been baked yet
+     */
+    juce::uint32 getVersion() const
+    {
+        return blockVersion;
+    }
+
+    /**
+     @return The table before this block's one while it is still safe to fade from, otherwise nullptr. The baker
+             cannot replace it until endBlock has marked this block's version as settled.
+     */
+    const MyWavetable* getFadeFromTable() const
+    {
+        return samplesSinceChange < fadeLength ? previousTable : nullptr;
+    }
+
+    /**
+     Puts a new table in the spare slot if the parameter has moved and the last table has settled, baking it unless
+     another instance already has. Baker thread only.
+
+     @return True if a new table was published
+     */
+    bool bakeIfChanged()
+    {
+        float target = *parameter;
+        if (target == bakedParameter)
+            return false;
+
+        juce::uint32 published = publishedState.load (std::memory_order_relaxed);
+        juce::uint32 version = published >> 1;
+        if (version != 0 && settledVersion.load (std::memory_order_acquire) != version)
+            return false;
+
+        int spare = version == 0 ? 0 : int (1 - (published & 1));
+
+        // Once the last table has settled nothing can still be reading the spare, so it can be let go of
+        ShapeFunction shapeFunction = shape;
+        MyTableCache::Key key { 0.0, MyTableCache::hash ({ (juce::uint64) reinterpret_cast<juce::pointer_sized_uint> (shapeFunction), MyTableCache::bitsOf (target) }) };
+        slots[spare] = tableCache->get<MyWavetable> (key, [shapeFunction, target] (MyWavetable& table) {
+            table.bake ([shapeFunction, target] (float phase) { return shapeFunction (phase, target); });
+        });
+
+        bakedParameter = target;
+        publishedState.store (((version + 1) << 1) | juce::uint32 (spare), std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<float>* parameter;
+    ShapeFunction shape;
+    MyTableCache* tableCache;
+
+    // Shared with any other instance playing the same tables, and only ever let go of on the baker thread
+    std::shared_ptr<const MyWavetable> slots[2];
+
+    // The version in the upper bits and the slot in the lowest bit, written by the baker thread
+    std::atomic<juce::uint32> publishedState { 0 };
+    float bakedParameter = std::numeric_limits<float>::quiet_NaN();
+
+    // Written by the audio thread
+    std::atomic<juce::uint32> settledVersion { 0 };
+    const MyWavetable* blockTable = nullptr;
+    const MyWavetable* previousTable = nullptr;
+    juce::uint32 blockVersion = 0;
+    int samplesSinceChange = fadeLength;
+};
+
+//==============================================================================
+class MyWavetableBaker
+{
+public:
+    ~MyWavetableBaker()
+    {
+        bakerThread->remove (this);
+    }
+
+    /**
+     Adds a shape to keep baked. Must be called before start.
+
+     @return The shape, owned by the baker
+     */
+    MyBakedShape* addShape (std::atomic<float>* parameter, MyBakedShape::ShapeFunction shape)
+    {
+        shapes.push_back (std::make_unique<MyBakedShape> (parameter, shape, &tableCache.get()));
+        return shapes.back().get();
+    }
+
+    /**
+     Hands the shapes to the shared baker thread.
+     */
+    void start()
+    {
+        bakerThread->add (this);
+    }
+
+    void beginBlock()
+    {
+        for (auto& shape : shapes)
+            shape->beginBlock();
+    }
+
+    void endBlock (int numSamples)
+    {
+        for (auto& shape : shapes)
+            shape->endBlock (numSamples);
+    }
+
+private:
+    /**
+     The one thread that bakes for every instance, held with juce::SharedResourcePointer.
+     */
+    class BakerThread : private juce::Thread
+    {
+    public:
+        BakerThread() : juce::Thread ("Wavetable Baker")
+        {
+            startThread();
+        }
+
+        ~BakerThread() override
+        {
+            stopThread (1000);
+        }
+
+        void add (MyWavetableBaker* baker)
+        {
+            const juce::ScopedLock sl (bakersLock);
+            bakers.push_back (baker);
+        }
+
+        /**
+         Stops baking for an instance, waiting for a bake in progress to finish.
+         */
+        void remove (MyWavetableBaker* baker)
+        {
+            const juce::ScopedLock sl (bakersLock);
+            bakers.erase (std::remove (bakers.begin(), bakers.end(), baker), bakers.end());
+        }
+
+    private:
+        std::vector<MyWavetableBaker*> bakers;
+        juce::CriticalSection bakersLock;
+
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                bool baked = false;
+                {
+                    const juce::ScopedLock sl (bakersLock);
+                    for (auto* baker : bakers)
+                        for (auto& shape : baker->shapes)
+                            baked = shape->bakeIfChanged() || baked;
+                }
+
+                // Parameters are polled, as they only need checking about as often as a control can move
+                if (! baked)
+                    wait (20);
+            }
+        }
+    };
+
+    juce::SharedResourcePointer<MyTableCache> tableCache;
+    juce::SharedResourcePointer<BakerThread> bakerThread;
+    std::vector<std::unique_ptr<MyBakedShape>> shapes;
+};
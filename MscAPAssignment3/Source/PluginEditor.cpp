@@ -11,11 +11,23 @@
 
 //==============================================================================
 APAssignment3AudioProcessorEditor::APAssignment3AudioProcessorEditor (APAssignment3AudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
+    : AudioProcessorEditor (&p), audioProcessor (p), parameterEditor (p)
 {
+    addAndMakeVisible (parameterEditor);
+
+    loadSampleButton.onClick = [this] { chooseSample(); };
+    addAndMakeVisible (loadSampleButton);
+    addAndMakeVisible (sampleLabel);
+    updateSampleLabel();
+
+    memoryLabel.setJustificationType (juce::Justification::centredRight);
+    addAndMakeVisible (memoryLabel);
+    timerCallback();
+    startTimer (1000);
+
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    setSize (parameterEditor.getWidth(), parameterEditor.getHeight() + sampleBarHeight);
 }
 
 APAssignment3AudioProcessorEditor::~APAssignment3AudioProcessorEditor()
@@ -27,14 +39,48 @@ void APAssignment3AudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-
-    g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
 }
 
 void APAssignment3AudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    auto bounds = getLocalBounds();
+    auto sampleBar = bounds.removeFromTop (sampleBarHeight).reduced (4);
+
+    loadSampleButton.setBounds (sampleBar.removeFromLeft (120));
+    memoryLabel.setBounds (sampleBar.removeFromRight (180));
+    sampleLabel.setBounds (sampleBar.withTrimmedLeft (8));
+    parameterEditor.setBounds (bounds);
+}
+
+//==============================================================================
+void APAssignment3AudioProcessorEditor::chooseSample()
+{
+    fileChooser = std::make_unique<juce::FileChooser> ("Choose a sample for the Sample oscillator type",
+                                                       audioProcessor.getSampleFile(),
+                                                       audioProcessor.getSampleFilePatterns());
+
+    auto flags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles;
+    fileChooser->launchAsync (flags, [this] (const juce::FileChooser& chooser) {
+        juce::File file = chooser.getResult();
+        if (file == juce::File())
+            return;
+
+        if (! audioProcessor.loadSample (file))
+            juce::AlertWindow::showMessageBoxAsync (juce::AlertWindow::WarningIcon, "Load Sample", "Could not read " + file.getFileName());
+
+        updateSampleLabel();
+    });
+}
+
+void APAssignment3AudioProcessorEditor::timerCallback()
+{
+    double megabytes = double (audioProcessor.getDspMemorySize()) / (1024.0 * 1024.0);
+    juce::String text = "DSP memory: " + juce::String (megabytes, 1) + " MB";
+    memoryLabel.setText (audioProcessor.isDspMemoryLocked() ? text + ", locked" : text, juce::dontSendNotification);
+}
+
+void APAssignment3AudioProcessorEditor::updateSampleLabel()
+{
+    juce::File file = audioProcessor.getSampleFile();
+    sampleLabel.setText (file == juce::File() ? "No sample loaded" : file.getFileName(), juce::dontSendNotification);
 }
@@ -14,7 +14,8 @@
 //==============================================================================
 /**
 */
-class APAssignment3AudioProcessorEditor : public juce::AudioProcessorEditor
+class APAssignment3AudioProcessorEditor : public juce::AudioProcessorEditor,
+                                          private juce::Timer
 {
 public:
     APAssignment3AudioProcessorEditor (APAssignment3AudioProcessor&);
@@ -29,5 +30,20 @@ private:
     // access the processor object that created it.
     APAssignment3AudioProcessor& audioProcessor;
 
+    // The parameters are still shown by the generic editor, with a bar above it for choosing the sample file.
+    juce::GenericAudioProcessorEditor parameterEditor;
+    juce::TextButton loadSampleButton { "Load Sample..." };
+    juce::Label sampleLabel;
+    juce::Label memoryLabel;
+    std::unique_ptr<juce::FileChooser> fileChooser;
+
+    static constexpr int sampleBarHeight = 32;
+
+    void chooseSample();
+    void updateSampleLabel();
+
+    // Keeps the memory label up to date, as the arena is laid out again whenever the processor is prepared
+    void timerCallback() override;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (APAssignment3AudioProcessorEditor)
 };
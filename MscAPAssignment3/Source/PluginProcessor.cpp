@@ -23,8 +23,10 @@ APAssignment3AudioProcessor::APAssignment3AudioProcessor()
                           ),
 #endif
       myParams (*this),
+      mySynth (&myParams),
       myNormalDelay (&myParams),
       myPingPongDelay (&myParams),
+      myMultiTapDelay (&myParams),
       myReverb (&myParams)
 {
     for (int i = 0; i < voiceCount; i++)
@@ -32,6 +34,8 @@ APAssignment3AudioProcessor::APAssignment3AudioProcessor()
         mySynth.addVoice (new MySynthVoice (&myParams));
     }
     mySynth.addSound (new MySynthSound());
+
+    formatManager.registerBasicFormats();
 }
 
 APAssignment3AudioProcessor::~APAssignment3AudioProcessor()
@@ -73,7 +77,24 @@ bool APAssignment3AudioProcessor::isMidiEffect() const
 
 double APAssignment3AudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    // The delay's echoes go on into the reverb, so the two tails add up
+    double tail = 0.0;
+
+    if (myParams.delayOn->get())
+    {
+        int delayType = int (*myParams.delayType);
+        if (delayType == 0)
+            tail = myNormalDelay.getTailSeconds();
+        else if (delayType == 1)
+            tail = myPingPongDelay.getTailSeconds();
+        else
+            tail = myMultiTapDelay.getTailSeconds();
+    }
+
+    if (myParams.reverbOn->get())
+        tail += myReverb.getTailSeconds();
+
+    return tail;
 }
 
 int APAssignment3AudioProcessor::getNumPrograms()
@@ -106,9 +127,52 @@ void APAssignment3AudioProcessor::prepareToPlay (double sampleRate, int samplesP
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
 
-    mySynth.setCurrentPlaybackSampleRate (sampleRate);
+    int numChannels = std::max (2, getTotalNumOutputChannels());
+
+    // Everything may be rendered in fixed blocks, see MyBlockAdapter.h, and the voices may run below the host rate,
+    // see MyEngineRate.h
+    int chainBlockSize = blockAdapter.prepare (myParams.qualityBlockSize->getIndex(), myParams.qualityBlockZeroLatency->get(), samplesPerBlock, numChannels);
+    engineRate.prepare (sampleRate, myParams.qualityEngineRate->getIndex() == 1, chainBlockSize, numChannels);
+
+    // The voices may also be rendered a block ahead on a worker thread, see MyPipeline.h
+    pipeline.prepare (myParams.qualityPipeline->get(), sampleRate, chainBlockSize, numChannels, [this] (juce::AudioBuffer<float>& voiceBuffer, const juce::MidiBuffer& voiceMidi, int numVoiceSamples) {
+        renderVoices (voiceBuffer, voiceMidi, numVoiceSamples);
+    });
+    setLatencySamples (blockAdapter.getLatency() + engineRate.getLatency() + pipeline.getLatency());
+
+    // With the pipeline on, its job also hands each voice out to the workers. The engine rate never renders more
+    // samples than the chain's block.
+    mySynth.setScheduler (pipeline.getScheduler(), chainBlockSize, numChannels);
+
+    // The delay lines are sized for the chosen longest delay, like the latency these only change when prepared
+    static constexpr float maxDelayTimes[] = { MyParameters::maxShortDelayTime, 8.0f, 32.0f };
+    float maxDelayTime = maxDelayTimes[myParams.delayMaxTime->getIndex()];
+    bool compactDelays = myParams.delayCompact->get();
+
+    // The voices' buffers, the delay lines and the reverb's buffer all live in one arena, see MyArena.h
+    arena.prepare ([this, sampleRate, chainBlockSize, maxDelayTime, compactDelays] (MyArena& layout) {
+        mySynth.allocate (layout);
+
+        // Only the chosen delay type runs, so they all share the memory of the largest
+        layout.overlap ([&] (MyArena& delayLayout) { myNormalDelay.allocate (delayLayout, sampleRate, maxDelayTime, compactDelays); },
+                        [&] (MyArena& delayLayout) { myPingPongDelay.allocate (delayLayout, sampleRate, maxDelayTime, compactDelays); },
+                        [&] (MyArena& delayLayout) { myMultiTapDelay.allocate (delayLayout, sampleRate, maxDelayTime, chainBlockSize, compactDelays); });
+
+        myReverb.allocate (layout, chainBlockSize);
+    });
+
+    // Faulting the pages in here keeps page faults out of the first callbacks, and locking them keeps them in RAM
+    if (myParams.qualityLockMemory->get())
+        arena.lockMemory();
+
+    dspMemorySize = arena.getSize();
+    dspMemoryLocked = arena.isMemoryLocked();
+
+    mySynth.setCurrentPlaybackSampleRate (engineRate.getEngineRate());
     myNormalDelay.prepareToPlay (sampleRate);
     myPingPongDelay.prepareToPlay (sampleRate);
+    myMultiTapDelay.prepareToPlay (sampleRate);
+    activeDelayType = int (*myParams.delayType);
     myReverb.prepareToPlay (sampleRate);
 }
 
@@ -116,6 +180,7 @@ void APAssignment3AudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    pipeline.stop();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -146,13 +211,65 @@ bool APAssignment3AudioProcessor::isBusesLayoutSupported (const BusesLayout& lay
 
 void APAssignment3AudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    auto startTicks = juce::Time::getHighResolutionTicks();
+
     int numSamples = buffer.getNumSamples();
+
+    myParams.quality.update (myParams.qualityMode->getIndex(), myParams.qualityRenderOffline->get(), isNonRealtime(), governor.getLevel());
+    blockAdapter.process (buffer, midiMessages, numSamples, [this] (juce::AudioBuffer<float>& blockBuffer, const juce::MidiBuffer& blockMidi, int numBlockSamples) {
+        renderChain (blockBuffer, blockMidi, numBlockSamples);
+    });
+
+    double processSeconds = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+    governor.update (myParams.qualityGovernor->get(), processSeconds, numSamples / getSampleRate(), myParams.quality.getSettings().cpuBudget);
+}
+
+void APAssignment3AudioProcessor::renderChain (juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages, int numSamples)
+{
+    if (pipeline.isActive())
+    {
+        pipeline.process (buffer, midiMessages, numSamples, [this] (juce::AudioBuffer<float>& effectsBuffer, int numEffectsSamples) {
+            applyEffects (effectsBuffer, numEffectsSamples);
+        });
+        return;
+    }
+
+    renderVoices (buffer, midiMessages, numSamples);
+    applyEffects (buffer, numSamples);
+}
+
+void APAssignment3AudioProcessor::renderVoices (juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages, int numSamples)
+{
+    engineRate.render (buffer, midiMessages, numSamples, [this] (juce::AudioBuffer<float>& engineBuffer, const juce::MidiBuffer& engineMidi, int numEngineSamples) {
+        mySynth.renderNextBlock (engineBuffer, engineMidi, 0, numEngineSamples);
+    });
+}
+
+void APAssignment3AudioProcessor::applyEffects (juce::AudioBuffer<float>& buffer, int numSamples)
+{
     int numChannels = buffer.getNumChannels();
-    mySynth.renderNextBlock (buffer, midiMessages, 0, numSamples);
-    if (int (*myParams.delayType) == 0)
+
+    int delayType = int (*myParams.delayType);
+
+    // The delay types share their memory, so a newly chosen one finds the last one's samples in its lines
+    if (delayType != activeDelayType)
+    {
+        if (delayType == 0)
+            myNormalDelay.discardLines();
+        else if (delayType == 1)
+            myPingPongDelay.discardLines();
+        else
+            myMultiTapDelay.discardLines();
+
+        activeDelayType = delayType;
+    }
+
+    if (delayType == 0)
         myNormalDelay.apply (buffer, numSamples, numChannels);
-    else
+    else if (delayType == 1)
         myPingPongDelay.apply (buffer, numSamples, numChannels);
+    else
+        myMultiTapDelay.apply (buffer, numSamples, numChannels);
     myReverb.apply (buffer, numSamples);
 }
 
@@ -164,8 +281,7 @@ bool APAssignment3AudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* APAssignment3AudioProcessor::createEditor()
 {
-    //    return new APAssignment3AudioProcessorEditor (*this);
-    return new juce::GenericAudioProcessorEditor (*this);
+    return new APAssignment3AudioProcessorEditor (*this);
 }
 
 //==============================================================================
@@ -189,10 +305,50 @@ void APAssignment3AudioProcessor::setStateInformation (const void* data, int siz
         if (xmlState->hasTagName (myParams.apvts.state.getType()))
         {
             myParams.apvts.replaceState (juce::ValueTree::fromXml (*xmlState));
+
+            juce::String samplePath = myParams.apvts.state.getProperty ("sample_file").toString();
+            if (samplePath.isNotEmpty())
+                loadSample (juce::File (samplePath));
         }
     }
 }
 
+//==============================================================================
+bool APAssignment3AudioProcessor::loadSample (const juce::File& file)
+{
+    // Opening the file and preloading the attack happens here, away from the audio thread.
+    std::shared_ptr<MySample> sample = MySample::load (file, formatManager);
+    if (sample == nullptr)
+        return false;
+
+    // Handed over without the callback lock, the audio thread picks it up at the start of its next block.
+    mySynth.setSample (std::move (sample));
+
+    myParams.apvts.state.setProperty ("sample_file", file.getFullPathName(), nullptr);
+    return true;
+}
+
+juce::File APAssignment3AudioProcessor::getSampleFile() const
+{
+    juce::String samplePath = myParams.apvts.state.getProperty ("sample_file").toString();
+    return samplePath.isNotEmpty() ? juce::File (samplePath) : juce::File();
+}
+
+juce::String APAssignment3AudioProcessor::getSampleFilePatterns() const
+{
+    return formatManager.getWildcardForAllFormats();
+}
+
+size_t APAssignment3AudioProcessor::getDspMemorySize() const
+{
+    return dspMemorySize;
+}
+
+bool APAssignment3AudioProcessor::isDspMemoryLocked() const
+{
+    return dspMemoryLocked;
+}
+
 //==============================================================================
 // This creates new instances of the plugin..
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
@@ -9,8 +9,13 @@
 
 #pragma once
 
+#include "MyArena.h"
+#include "MyBlockAdapter.h"
 #include "MyDelay.h"
+#include "MyEngineRate.h"
+#include "MyGovernor.h"
 #include "MyParameters.h"
+#include "MyPipeline.h"
 #include "MyReverb.h"
 #include "MySynth.h"
 #include <JuceHeader.h>
@@ -60,17 +65,92 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
 
     //==============================================================================
+    /**
+     Loads a sample for the Sample oscillator type and remembers it in the plugin state.
+
+     @param file The WAV, FLAC or other audio file to play
+     @return True if the file could be read
+     */
+    bool loadSample (const juce::File& file);
+
+    /**
+     @return The sample file remembered in the plugin state, or juce::File() if there is none
+     */
+    juce::File getSampleFile() const;
+
+    /**
+     @return The wildcard patterns of the audio files loadSample can read, for a file chooser
+     */
+    juce::String getSampleFilePatterns() const;
+
+    /**
+     @return The bytes of DSP buffers this instance uses, as laid out in its arena when last prepared
+     */
+    size_t getDspMemorySize() const;
+
+    /**
+     @return True if the arena was locked in RAM when last prepared
+     */
+    bool isDspMemoryLocked() const;
+
+    //==============================================================================
 
 private:
     MyParameters myParams;
 
-    juce::Synthesiser mySynth;
+    // Every DSP buffer, declared first so it outlives everything that points into it
+    MyArena arena;
+
+    // Copied from the arena after it is prepared, for the editor to read
+    std::atomic<size_t> dspMemorySize { 0 };
+    std::atomic<bool> dspMemoryLocked { false };
+
+    MySynthesiser mySynth;
     int voiceCount = 16;
 
+    MyEngineRate engineRate;
+    MyBlockAdapter blockAdapter;
+
+    juce::AudioFormatManager formatManager;
+
     MyDelay myNormalDelay;
     MyPingPongDelay myPingPongDelay;
+    MyMultiTapDelay myMultiTapDelay;
+    // The delay type that ran last, as the types share their lines in the arena
+    int activeDelayType = 0;
     MyReverb myReverb;
 
+    MyGovernor governor;
+
+    // Declared after everything its voice jobs render with
+    MyPipeline pipeline;
+
+    /**
+     Renders the synth and effects into a buffer, which is either the host's or one of the block adapter's.
+
+     @param buffer The buffer to render into
+     @param midiMessages The MIDI events for the buffer
+     @param numSamples The number of samples to render
+     */
+    void renderChain (juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages, int numSamples);
+
+    /**
+     Renders the voices into a buffer at the host rate. Called on a scheduler worker when the pipeline is on.
+
+     @param buffer The buffer to add the voices to
+     @param midiMessages The MIDI events for the buffer
+     @param numSamples The number of samples to render
+     */
+    void renderVoices (juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages, int numSamples);
+
+    /**
+     Runs the delay and reverb over a buffer.
+
+     @param buffer The buffer to process
+     @param numSamples The number of samples to process
+     */
+    void applyEffects (juce::AudioBuffer<float>& buffer, int numSamples);
+
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (APAssignment3AudioProcessor)
 };
@@ -0,0 +1,14 @@
+/*
+  ==============================================================================
+
+    JuceHeader.h
+
+    Stands in for the Projucer's JuceHeader.h in the standalone tests, which
+    only need juce_core.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>